@@ -0,0 +1,420 @@
+/*
+ * compare parseRequestLine() with the former std::regex request line match
+ * on a corpus of real request lines, report lines parsed per second.
+ * then check every scanner level gives same result as scalar one
+ * on random buffers, fuzz the request parser against the byte loop
+ * one it replaced, and compare scanner speed on header blocks.
+ *
+ * usage: parse_bench [rounds]
+ */
+#include <cctype>
+#include <chrono>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "http_parser.h"
+
+static const char *corpus[] = {
+        "GET / HTTP/1.1",
+        "GET /funny_box.html HTTP/1.1",
+        "GET /random_funny HTTP/1.1",
+        "GET /favicon.ico HTTP/1.1",
+        "GET /box/3.jpg HTTP/1.1",
+        "GET /static/js/app.3f9a1c.js HTTP/1.1",
+        "GET /static/css/main.css?v=20211104 HTTP/1.1",
+        "GET /api/v1/users?page=2&per_page=50&sort=created_at HTTP/1.1",
+        "POST /api/v1/login HTTP/1.1",
+        "POST /upload/photo.jpg HTTP/1.1",
+        "HEAD /index.html HTTP/1.0",
+        "GET /search?q=tiny+server+epoll&lang=zh-CN&utm_source=newsletter&utm_medium=email HTTP/1.1",
+        "PUT /api/v1/items/42 HTTP/1.1",
+        "DELETE /api/v1/items/42 HTTP/1.1",
+        "OPTIONS * HTTP/1.1",
+        "GET /images/2021/11/%E7%9B%B2%E7%9B%92.png HTTP/1.1",
+};
+
+static const char *header_block =
+        "Host: www.example.com:8080\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/95.0 Safari/537.36\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+        "Cache-Control: max-age=0\r\n"
+        "Connection: keep-alive\r\n"
+        "Cookie: session=8f14e45fceea167a5a36dedd4bea2543; theme=dark; _ga=GA1.2.1234567890.1636000000\r\n"
+        "If-None-Match: \"5f8a-61839a2b\"\r\n"
+        "If-Modified-Since: Thu, 04 Nov 2021 08:00:00 GMT\r\n"
+        "Upgrade-Insecure-Requests: 1\r\n"
+        "\r\n";
+
+static inline double nowSec() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static const char *header_names[HDR_COUNT] = {
+        "Host", "Connection", "Content-Length", "Transfer-Encoding", "Accept-Encoding", "If-None-Match",
+        "If-Modified-Since", "Range", "If-Range", "User-Agent", "Expect",
+};
+
+enum PARSE_VERDICT {
+    PARSE_OK = 0, PARSE_OPEN, PARSE_BAD,
+};
+
+// what both parsers tell about request line and header block
+struct Parsed {
+    PARSE_VERDICT verdict = PARSE_OPEN;
+    HTTP_METHOD method = GET;
+    std::string path;
+    HTTP_VERSION version = HTTP_1_1;
+    bool keep_alive = false;
+    bool has[HDR_COUNT] = {};
+    std::string values[HDR_COUNT];
+    std::string content_length;     // raw value, last one wins
+    bool strict = false;            // legacy only: saw a line new parser rejects
+};
+
+static void trimValue(const char *&value, const char *&end) {
+    while (value < end && (*value == ' ' || *value == '\t'))
+        ++value;
+    while (end > value && (*(end - 1) == ' ' || *(end - 1) == '\t'))
+        --end;
+}
+
+/*
+ * HttpConn parser before SIMD scanning: byte loop line split,
+ * strncasecmp on "Name:" prefixes. it only looked at Content-Length
+ * and Connection, other table headers are read the same way.
+ */
+static Parsed legacyParse(std::string buf) {
+    Parsed r;
+    size_t ind = 0, start = 0;
+    bool request = true;
+    for (;;) {
+        PARSE_VERDICT line = PARSE_OPEN;
+        for (; ind < buf.size(); ++ind) {
+            if (buf[ind] == '\r') {
+                if (ind + 1 == buf.size())
+                    break;
+                if (buf[ind + 1] != '\n') {
+                    line = PARSE_BAD;
+                    break;
+                }
+                buf[ind++] = '\0';
+                buf[ind++] = '\0';
+                line = PARSE_OK;
+                break;
+            } else if (buf[ind] == '\n') {
+                line = PARSE_BAD;
+                break;
+            }
+        }
+        if (line != PARSE_OK) {
+            r.verdict = line;
+            return r;
+        }
+
+        char *text = &buf[start];
+        start = ind;
+        if (request) {
+            RequestLine req_line;
+            if (!parseRequestLine(text, strlen(text), req_line)) {
+                r.verdict = PARSE_BAD;
+                return r;
+            }
+            r.method = req_line.method;
+            r.path.assign(req_line.target.data, req_line.target.size);
+            r.version = req_line.version;
+            r.keep_alive = r.version == HTTP_1_1;
+            request = false;
+            continue;
+        }
+        if (*text == '\0') {
+            r.verdict = PARSE_OK;
+            return r;
+        }
+
+        const char *colon = strchr(text, ':');
+        if (colon == nullptr || colon == text)
+            r.strict = true;
+        if (strncasecmp(text, "Connection:", 11) == 0) {
+            const char *value = text + 11 + strspn(text + 11, " \t");
+            if (strncasecmp(value, "close", 5) == 0)
+                r.keep_alive = false;
+            else if (strncasecmp(value, "keep-alive", 10) == 0)
+                r.keep_alive = true;
+        }
+        for (int id = 0; id < HDR_COUNT; ++id) {
+            size_t len = strlen(header_names[id]);
+            if (strncasecmp(text, header_names[id], len) != 0 || text[len] != ':')
+                continue;
+            const char *value = text + len + 1, *end = text + strlen(text);
+            trimValue(value, end);
+            r.has[id] = true;
+            r.values[id].assign(value, end);
+            if (id == HDR_CONTENT_LENGTH)
+                r.content_length = r.values[id];
+        }
+    }
+}
+
+// HttpConn::parseLine() and parseHeaders() as they are now
+static Parsed currentParse(std::string buf) {
+    Parsed r;
+    HeaderTable headers;
+    headers.clear();
+    char *base = &buf[0];
+    const char *end = base + buf.size();
+    size_t ind = 0;
+    bool request = true;
+    for (;;) {
+        const char *p = findAnyOf2(base + ind, end, '\r', '\n');
+        if (p == end || p + 1 == end) {
+            r.verdict = PARSE_OPEN;
+            return r;
+        }
+        if (*p == '\n' || *(p + 1) != '\n') {
+            r.verdict = PARSE_BAD;
+            return r;
+        }
+        char *line = base + ind;
+        ind = p - base;
+        base[ind++] = '\0';
+        base[ind++] = '\0';
+
+        if (request) {
+            RequestLine req_line;
+            if (!parseRequestLine(line, strlen(line), req_line)) {
+                r.verdict = PARSE_BAD;
+                return r;
+            }
+            r.method = req_line.method;
+            r.path.assign(req_line.target.data, req_line.target.size);
+            r.version = req_line.version;
+            r.keep_alive = r.version == HTTP_1_1;
+            request = false;
+            continue;
+        }
+        if (*line == '\0')
+            break;
+
+        const char *line_end = line + strlen(line);
+        const char *colon = findAnyOf2(line, line_end, ':', ':');
+        if (colon == line_end || colon == line) {
+            r.verdict = PARSE_BAD;
+            return r;
+        }
+        HEADER_ID id = matchHeaderName(line, colon - line);
+        if (id == HDR_COUNT)
+            continue;
+        const char *value = colon + 1;
+        trimValue(value, line_end);
+        headers.set(id, static_cast<int32_t>(value - base), static_cast<int32_t>(line_end - value));
+        if (id == HDR_CONNECTION) {
+            if (strncasecmp(value, "close", 5) == 0)
+                r.keep_alive = false;
+            else if (strncasecmp(value, "keep-alive", 10) == 0)
+                r.keep_alive = true;
+        }
+    }
+
+    r.verdict = PARSE_OK;
+    for (int id = 0; id < HDR_COUNT; ++id) {
+        const HeaderTable::Slice &slice = headers.slices[id];
+        r.has[id] = headers.has(static_cast<HEADER_ID>(id));
+        if (r.has[id])
+            r.values[id].assign(base + slice.offset, slice.size);
+    }
+    r.content_length = r.values[HDR_CONTENT_LENGTH];
+    return r;
+}
+
+template<size_t N>
+static const char *pick(std::mt19937 &rng, const char *const (&list)[N]) {
+    return list[rng() % N];
+}
+
+// random request head, mostly well formed, sometimes broken or cut
+static std::string fuzzRequest(std::mt19937 &rng) {
+    static const char *const methods[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "OPTIONS", "PATCH", "get", "GETX", ""};
+    static const char *const targets[] = {"/", "/index.html", "/a%20b?x=1&y=2", "*", "/upload/f1.txt", "", "/a b"};
+    static const char *const versions[] = {"HTTP/1.1", "HTTP/1.0", "HTTP/2.0", "http/1.1", "HTTP/1.1 "};
+    static const char *const unknown[] = {"Accept", "Cookie", "X-Forwarded-For", "Hosts", "Content-Lengths", "Rang"};
+    static const char *const seps[] = {":", ": ", ":\t", ":  ", " :"};
+    static const char *const values[] = {"0", "42", "123456789", "12a", "-1", "+5", "", "close", "Close",
+                                         "keep-alive", "Keep-Alive, Upgrade", "gzip, br", "bytes=0-99",
+                                         "\"5f8a-61839a2b\"", "a:b", "100-continue", "chunked"};
+    static const char *const trails[] = {"", "", " ", "\t ", "  "};
+
+    std::string req = pick(rng, methods);
+    req += rng() % 16 ? " " : "  ";
+    req += pick(rng, targets);
+    req += " ";
+    req += pick(rng, versions);
+    req += "\r\n";
+
+    int header_num = rng() % 9;
+    for (int i = 0; i < header_num; ++i) {
+        std::string line = rng() % 4 ? header_names[rng() % HDR_COUNT] : pick(rng, unknown);
+        for (auto &c : line) {
+            if (rng() % 4 == 0)
+                c = isupper(c) ? tolower(c) : toupper(c);
+        }
+        line += pick(rng, seps);
+        line += pick(rng, values);
+        line += pick(rng, trails);
+        switch (rng() % 24) {
+            case 0:     // no colon
+                line.erase(line.find(':'), 1);
+                break;
+            case 1:     // empty name
+                line = ":" + line;
+                break;
+            case 2:     // bare CR or LF inside line
+                line.insert(rng() % (line.size() + 1), 1, rng() % 2 ? '\r' : '\n');
+                break;
+            default:
+                break;
+        }
+        req += line + "\r\n";
+    }
+    if (rng() % 10)
+        req += "\r\n";
+    if (rng() % 5 == 0)
+        req.resize(rng() % (req.size() + 1));
+    return req;
+}
+
+int main(int argc, char **argv) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 200000;
+    const int line_num = sizeof(corpus) / sizeof(corpus[0]);
+    std::vector<std::string> lines(corpus, corpus + line_num);
+
+    // the request line regex HttpConn used before
+    std::regex req_re("^(GET|POST)\\s([^\\s]+)\\s(HTTP\\/1\\.1)$", std::regex::icase);
+    size_t checksum = 0;
+    double start = nowSec();
+    for (int r = 0; r < rounds; ++r) {
+        for (auto &line : lines) {
+            std::cmatch matcher;
+            if (std::regex_match(line.c_str(), matcher, req_re))
+                checksum += matcher[2].length();
+        }
+    }
+    double regex_sec = nowSec() - start;
+
+    start = nowSec();
+    for (int r = 0; r < rounds; ++r) {
+        for (auto &line : lines) {
+            RequestLine req_line;
+            if (parseRequestLine(line.data(), line.size(), req_line))
+                checksum += req_line.target.size;
+        }
+    }
+    double parser_sec = nowSec() - start;
+
+    double total = static_cast<double>(rounds) * line_num;
+    printf("std::regex      %12.0f lines/s\n", total / regex_sec);
+    printf("parseRequestLine %11.0f lines/s   (%.1fx)\n", total / parser_sec, regex_sec / parser_sec);
+
+    // every scanner must agree with scalar one at every start offset
+    std::mt19937 rng(20211104);
+    const char alphabet[] = "ab:\r\n \t";
+    std::vector<const char *> expect;
+    std::string buf;
+    for (int t = 0; t < 2000; ++t) {
+        buf.resize(rng() % 200);
+        for (auto &c : buf)
+            c = alphabet[rng() % (sizeof(alphabet) - 1)];
+        const char *end = buf.data() + buf.size();
+        for (int level = SCAN_SCALAR; level <= SCAN_AVX2; ++level) {
+            if (!setScanLevel(static_cast<SCAN_LEVEL>(level)))
+                continue;
+            for (size_t i = 0; i <= buf.size(); ++i) {
+                const char *got = findAnyOf2(buf.data() + i, end, '\r', '\n');
+                const char *got_colon = findAnyOf2(buf.data() + i, end, ':', ':');
+                if (level == SCAN_SCALAR) {
+                    if (i == 0)
+                        expect.clear();
+                    expect.push_back(got);
+                    expect.push_back(got_colon);
+                } else if (got != expect[2 * i] || got_colon != expect[2 * i + 1]) {
+                    printf("scanner %s differs from scalar\n", scanLevelName(static_cast<SCAN_LEVEL>(level)));
+                    return 1;
+                }
+            }
+        }
+    }
+    printf("scanners agree on random buffers\n");
+
+    /*
+     * new parser must read every request head as the old one did, except
+     * where it is stricter on purpose: a header line without name or ':'
+     * is 400, and Content-Length must be digits only (checked later by
+     * beginBody()), where old one ignored the line or took atoi().
+     */
+    const int fuzz_num = 20000;
+    int rejected_lines = 0, rejected_lengths = 0;
+    for (int level = SCAN_SCALAR; level <= SCAN_AVX2; ++level) {
+        if (!setScanLevel(static_cast<SCAN_LEVEL>(level)))
+            continue;
+        std::mt19937 fuzz_rng(20211104);
+        for (int t = 0; t < fuzz_num; ++t) {
+            std::string req = fuzzRequest(fuzz_rng);
+            Parsed old_r = legacyParse(req), new_r = currentParse(req);
+            PARSE_VERDICT expect_verdict = old_r.strict ? PARSE_BAD : old_r.verdict;
+            bool same = new_r.verdict == expect_verdict;
+            if (same && new_r.verdict == PARSE_OK) {
+                same = new_r.method == old_r.method && new_r.path == old_r.path &&
+                       new_r.version == old_r.version && new_r.keep_alive == old_r.keep_alive;
+                for (int id = 0; id < HDR_COUNT; ++id)
+                    same = same && new_r.has[id] == old_r.has[id] && new_r.values[id] == old_r.values[id];
+                if (old_r.has[HDR_CONTENT_LENGTH]) {
+                    const std::string &value = new_r.content_length;
+                    int64_t length = parseContentLength(value.data(), value.size());
+                    if (length < 0)
+                        rejected_lengths += level == SCAN_SCALAR;
+                    else
+                        same = same && length == atoi(old_r.content_length.c_str());
+                }
+            }
+            if (old_r.strict && old_r.verdict != PARSE_BAD)
+                rejected_lines += level == SCAN_SCALAR;
+            if (!same) {
+                printf("parser %s differs from old one (verdict %d, old %d) on:\n%s\n",
+                       scanLevelName(static_cast<SCAN_LEVEL>(level)), new_r.verdict, old_r.verdict, req.c_str());
+                return 1;
+            }
+        }
+    }
+    printf("parsers agree on %d fuzzed requests, %d stricter header lines, %d stricter lengths\n",
+           fuzz_num, rejected_lines, rejected_lengths);
+
+    // split header block into lines and names like HttpConn does
+    const char *block_end = header_block + strlen(header_block);
+    for (int level = SCAN_SCALAR; level <= SCAN_AVX2; ++level) {
+        if (!setScanLevel(static_cast<SCAN_LEVEL>(level)))
+            continue;
+        start = nowSec();
+        for (int r = 0; r < rounds; ++r) {
+            const char *p = header_block;
+            while (p < block_end) {
+                const char *line_end = findAnyOf2(p, block_end, '\r', '\n');
+                const char *colon = findAnyOf2(p, line_end, ':', ':');
+                if (colon != line_end)
+                    checksum += matchHeaderName(p, colon - p);
+                p = line_end + 2;
+            }
+        }
+        printf("header scan %-7s %10.0f blocks/s\n", scanLevelName(static_cast<SCAN_LEVEL>(level)),
+               rounds / (nowSec() - start));
+    }
+
+    printf("checksum %zu\n", checksum);
+    return 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * register a few hundred REST style routes in Router, check a set of
+ * request targets resolve to the expected pattern and parameters,
+ * then compare lookups per second with a strcmp chain over the same
+ * static paths (how HttpConn routed before) and an unordered_map.
+ *
+ * usage: route_bench [resources] [rounds]
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "router.h"
+
+static inline double nowSec() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static HTTP_CODE nop(HttpConn &, const RouteMatch &) {
+    return NO_REQUEST;
+}
+
+struct Probe {
+    HTTP_METHOD method;
+    std::string target;
+    const char *pattern;        // expected route, nullptr if none
+    ROUTE_RESULT result;
+    const char *param_name;
+    const char *param_value;
+};
+
+static bool check(const Router &router, const Probe &probe) {
+    RouteMatch match;
+    ROUTE_RESULT result = router.match(probe.method, probe.target.data(), probe.target.size(), match);
+    bool ok = result == probe.result;
+    if (ok && result == ROUTE_FOUND)
+        ok = match.route->pattern == probe.pattern;
+    if (ok && probe.param_name != nullptr) {
+        StrView value = match.param(probe.param_name);
+        ok = value.data != nullptr && value.size == strlen(probe.param_value) &&
+             memcmp(value.data, probe.param_value, value.size) == 0;
+    }
+    if (!ok)
+        printf("%s %s: wrong match (result %d)\n", methodName(probe.method), probe.target.c_str(), result);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    int resources = argc > 1 ? atoi(argv[1]) : 60;
+    int rounds = argc > 2 ? atoi(argv[2]) : 20000;
+    Router &router = Router::instance();
+
+    // per resource: collection, item, nested collection, item action, an rpc style path
+    std::vector<std::string> static_paths;
+    char path[128];
+    for (int i = 0; i < resources; ++i) {
+        snprintf(path, sizeof(path), "/api/v%d/resource%d", i % 3 + 1, i);
+        std::string base = path;
+        router.registerHandler(GET, base.c_str(), nop);
+        router.registerHandler(POST, base.c_str(), nop);
+        router.registerHandler(GET, (base + "/:id").c_str(), nop);
+        router.registerHandler(DELETE, (base + "/:id").c_str(), nop);
+        router.registerHandler(GET, (base + "/:id/children").c_str(), nop);
+        router.registerHandler(POST, (base + "/:id/archive").c_str(), nop);
+        router.registerHandler(GET, (base + "/search").c_str(), nop);
+        static_paths.push_back(base);
+        static_paths.push_back(base + "/search");
+    }
+    for (int i = 0; i < 20; ++i) {
+        snprintf(path, sizeof(path), "/page%d.html", i);
+        router.registerHandler(GET, path, nop);
+        static_paths.push_back(path);
+    }
+    router.registerHandler(GET, "/static/*file", nop);
+    router.registerHandler(GET, "/static/app/manifest.json", nop);
+    router.registerHandler(GET, "/", nop);
+    static_paths.push_back("/");
+    printf("%zu routes, %zu static paths\n", router.routeCount(), static_paths.size());
+
+    // correctness
+    std::vector<Probe> probes = {
+            {GET, "/", "/", ROUTE_FOUND, nullptr, nullptr},
+            {HEAD, "/page3.html", "/page3.html", ROUTE_FOUND, nullptr, nullptr},
+            {GET, "/api/v1/resource0", "/api/v1/resource0", ROUTE_FOUND, nullptr, nullptr},
+            {GET, "/api/v1/resource3/search?q=x", "/api/v1/resource3/search", ROUTE_FOUND, nullptr, nullptr},
+            {GET, "/api/v1/resource3/42", "/api/v1/resource3/:id", ROUTE_FOUND, "id", "42"},
+            {GET, "/api/v2/resource1/7/children", "/api/v2/resource1/:id/children", ROUTE_FOUND, "id", "7"},
+            {POST, "/api/v2/resource1/7/archive", "/api/v2/resource1/:id/archive", ROUTE_FOUND, "id", "7"},
+            {PUT, "/api/v2/resource1/7", nullptr, ROUTE_BAD_METHOD, nullptr, nullptr},
+            {GET, "/api/v2/resource1/7/other", nullptr, ROUTE_NOT_FOUND, nullptr, nullptr},
+            {GET, "/api/v1/resource1", nullptr, ROUTE_NOT_FOUND, nullptr, nullptr},
+            {GET, "/static/css/main.css", "/static/*file", ROUTE_FOUND, "file", "css/main.css"},
+            {GET, "/static/app/manifest.json", "/static/app/manifest.json", ROUTE_FOUND, nullptr, nullptr},
+            {GET, "/static/app/other.json", "/static/*file", ROUTE_FOUND, "file", "app/other.json"},
+            {GET, "/static/", "/static/*file", ROUTE_FOUND, "file", ""},
+            {GET, "/page3.htm", nullptr, ROUTE_NOT_FOUND, nullptr, nullptr},
+    };
+    bool ok = true;
+    for (auto &probe : probes)
+        ok = check(router, probe) && ok;
+    if (!ok)
+        return 1;
+    printf("%zu probes match\n", probes.size());
+
+    // lookup speed, targets mix static, parameter and miss
+    std::vector<std::string> targets;
+    for (int i = 0; i < resources; i += 7) {
+        snprintf(path, sizeof(path), "/api/v%d/resource%d", i % 3 + 1, i);
+        targets.push_back(path);
+        targets.push_back(std::string(path) + "/123456");
+        targets.push_back(std::string(path) + "/99/children");
+    }
+    targets.push_back("/");
+    targets.push_back("/page19.html");
+    targets.push_back("/static/js/app.3f9a1c.js");
+    targets.push_back("/favicon.ico");
+
+    size_t checksum = 0;
+    size_t lookups = static_cast<size_t>(rounds) * targets.size();
+    double start = nowSec();
+    for (int r = 0; r < rounds; ++r) {
+        for (auto &target : targets) {
+            RouteMatch match;
+            if (router.match(GET, target.data(), target.size(), match) == ROUTE_FOUND)
+                checksum += match.param_count + 1;
+        }
+    }
+    double trie_sec = nowSec() - start;
+
+    // former routing: strcmp against every static path in turn
+    start = nowSec();
+    for (int r = 0; r < rounds; ++r) {
+        for (auto &target : targets) {
+            for (size_t i = 0; i < static_paths.size(); ++i) {
+                if (strcmp(target.c_str(), static_paths[i].c_str()) == 0) {
+                    checksum += i;
+                    break;
+                }
+            }
+        }
+    }
+    double chain_sec = nowSec() - start;
+
+    std::unordered_map<std::string, size_t> table;
+    for (size_t i = 0; i < static_paths.size(); ++i)
+        table.emplace(static_paths[i], i);
+    start = nowSec();
+    for (int r = 0; r < rounds; ++r) {
+        for (auto &target : targets) {
+            auto it = table.find(target);
+            if (it != table.end())
+                checksum += it->second;
+        }
+    }
+    double map_sec = nowSec() - start;
+
+    printf("radix trie      %12.0f lookups/s  (static, :param and * routes)\n", lookups / trie_sec);
+    printf("strcmp chain    %12.0f lookups/s  (static paths only)\n", lookups / chain_sec);
+    printf("unordered_map   %12.0f lookups/s  (static paths only)\n", lookups / map_sec);
+    printf("checksum %zu\n", checksum);
+    return 0;
+}
@@ -0,0 +1,54 @@
+#!/bin/sh
+# start TinyServer on loopback and record tinyserver_bench results
+#
+# usage: bench/run_bench.sh [build_dir] [result_file]
+#   SECONDS_PER_RUN  seconds every scenario runs, default 10
+#   PORT             loopback port, default 18081
+#   SERVER_OPTS      extra TinyServer options, e.g. "-n 2"
+set -e
+
+src_dir=$(cd "$(dirname "$0")/.." && pwd)
+build_dir=$(cd "${1:-$src_dir/_gate_build}" && pwd)
+result_file=${2:-$build_dir/bench_results.txt}
+seconds=${SECONDS_PER_RUN:-10}
+port=${PORT:-18081}
+
+server=$build_dir/TinyServer
+bench=$build_dir/tinyserver_bench
+[ -x "$server" ] && [ -x "$bench" ] || { echo "build TinyServer and tinyserver_bench first"; exit 1; }
+
+# the server chdirs into ./root, index.html and funny_mystery_box are not shipped
+work_dir=$(mktemp -d)
+cp -r "$src_dir/root" "$work_dir/root"
+mkdir -p "$work_dir/root/funny_mystery_box"
+[ -f "$work_dir/root/index.html" ] || echo "<html><body>TinyServer</body></html>" > "$work_dir/root/index.html"
+if [ -z "$(ls "$work_dir/root/funny_mystery_box")" ]; then
+    head -c 4096 /dev/urandom > "$work_dir/root/funny_mystery_box/small.png"
+    head -c 65536 /dev/urandom > "$work_dir/root/funny_mystery_box/medium.jpg"
+    head -c 1048576 /dev/urandom > "$work_dir/root/funny_mystery_box/large.jpg"
+fi
+
+cd "$work_dir"
+"$server" -m 1000000 $SERVER_OPTS "$port" > "$work_dir/server.log" 2>&1 &
+server_pid=$!
+trap 'kill $server_pid 2>/dev/null; wait $server_pid 2>/dev/null; rm -rf "$work_dir"' EXIT
+sleep 1
+
+run() {
+    echo "== $*" | tee -a "$result_file"
+    "$bench" -d "$seconds" "$@" "$port" | tee -a "$result_file"
+    echo | tee -a "$result_file"
+}
+
+{
+    echo "# $(date '+%F %T')  $(git -C "$src_dir" rev-parse --short HEAD 2>/dev/null)  server opts: $SERVER_OPTS"
+    echo "# $(uname -srm)  $(nproc) cpus"
+} | tee -a "$result_file"
+
+run -c 64 -u /
+run -c 64 -u /funny_box.html
+run -c 64 -u /random_funny
+run -c 64
+run -c 64 -p 8
+run -c 256 -p 1
+run -c 64 -k 0
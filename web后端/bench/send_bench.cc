@@ -0,0 +1,129 @@
+/*
+ * compare the two send engines of HttpConn over loopback tcp:
+ * mmap + writev(header, body) against send(header, MSG_MORE) + sendfile(body).
+ * file is mapped / opened once like FileCache does.
+ *
+ * usage: send_bench [total_mb]
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+
+static inline double nowSec() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void connectPair(int &client, int &server) {
+    int listen_fd = socket(PF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    bind(listen_fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address));
+    socklen_t len = sizeof(address);
+    getsockname(listen_fd, reinterpret_cast<struct sockaddr *>(&address), &len);
+    listen(listen_fd, 1);
+    client = socket(PF_INET, SOCK_STREAM, 0);
+    connect(client, reinterpret_cast<struct sockaddr *>(&address), sizeof(address));
+    server = accept(listen_fd, nullptr, nullptr);
+    close(listen_fd);
+}
+
+static bool writevAll(int sock, const std::string &header, const char *body, size_t size) {
+    struct iovec vec[2] = {{const_cast<char *>(header.data()), header.size()},
+                           {const_cast<char *>(body), size}};
+    size_t total = header.size() + size, have_send = 0;
+    while (have_send < total) {
+        ssize_t bytes = writev(sock, vec, 2);
+        if (bytes <= 0)
+            return false;
+        have_send += bytes;
+        if (have_send < header.size()) {
+            vec[0].iov_base = const_cast<char *>(header.data()) + have_send;
+            vec[0].iov_len = header.size() - have_send;
+        } else {
+            vec[0].iov_len = 0;
+            vec[1].iov_base = const_cast<char *>(body) + (have_send - header.size());
+            vec[1].iov_len = total - have_send;
+        }
+    }
+    return true;
+}
+
+static bool sendfileAll(int sock, const std::string &header, int fd, size_t size) {
+    size_t have_send = 0;
+    while (have_send < header.size()) {
+        ssize_t bytes = send(sock, header.data() + have_send, header.size() - have_send, MSG_MORE);
+        if (bytes <= 0)
+            return false;
+        have_send += bytes;
+    }
+    off_t offset = 0;
+    while (static_cast<size_t>(offset) < size) {
+        if (sendfile(sock, fd, &offset, size - offset) <= 0)
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    size_t total = (argc > 1 ? atol(argv[1]) : 2048) * 1024L * 1024L;
+    const size_t sizes[] = {4 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024, 8 * 1024 * 1024};
+    printf("%10s %18s %18s\n", "body", "mmap+writev MB/s", "sendfile MB/s");
+    for (size_t size : sizes) {
+        char path[] = "/tmp/send_bench_XXXXXX";
+        int fd = mkstemp(path);
+        unlink(path);
+        std::string chunk(size, 'x');
+        write(fd, chunk.data(), size);
+        char *address = reinterpret_cast<char *>(mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0));
+        std::string header = "HTTP/1.1 200 OK\r\nContent-Type: image/jpeg\r\nContent-Length: " +
+                             std::to_string(size) + "\r\nConnection: keep-alive\r\n\r\n";
+        size_t rounds = total / size > 0 ? total / size : 1;
+
+        double result[2];
+        for (int engine = 0; engine < 2; ++engine) {
+            int client, server;
+            connectPair(client, server);
+            size_t expect = rounds * (header.size() + size);
+            std::thread reader([client, expect]() {
+                static char buf[256 * 1024];
+                size_t got = 0;
+                while (got < expect) {
+                    ssize_t bytes = read(client, buf, sizeof(buf));
+                    if (bytes <= 0)
+                        break;
+                    got += bytes;
+                }
+            });
+            double start = nowSec();
+            for (size_t i = 0; i < rounds; ++i) {
+                if (engine == 0)
+                    writevAll(server, header, address, size);
+                else
+                    sendfileAll(server, header, fd, size);
+            }
+            reader.join();
+            result[engine] = expect / (nowSec() - start) / (1024 * 1024);
+            close(client);
+            close(server);
+        }
+        printf("%10zu %18.0f %18.0f\n", size, result[0], result[1]);
+        fflush(stdout);
+        munmap(address, size);
+        close(fd);
+    }
+    return 0;
+}
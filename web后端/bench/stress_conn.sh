@@ -0,0 +1,39 @@
+#!/bin/sh
+# stress connection ownership: every request goes to the ThreadPool (-i 0)
+# while clients keep pipelining requests in small segments, so the reactor
+# has new bytes for a connection whenever a worker is parsing it.
+# tinyserver_bench -V fails on any response not matching its url.
+#
+# usage: bench/stress_conn.sh [build_dir]
+#   SECONDS_PER_RUN  seconds of each run, default 10
+#   PORT             loopback port, default 18082
+#   SERVER_OPTS      extra TinyServer options, e.g. "-n 2"
+set -e
+
+src_dir=$(cd "$(dirname "$0")/.." && pwd)
+build_dir=$(cd "${1:-$src_dir/_gate_build}" && pwd)
+seconds=${SECONDS_PER_RUN:-10}
+port=${PORT:-18082}
+
+server=$build_dir/TinyServer
+bench=$build_dir/tinyserver_bench
+[ -x "$server" ] && [ -x "$bench" ] || { echo "build TinyServer and tinyserver_bench first"; exit 1; }
+
+work_dir=$(mktemp -d)
+mkdir -p "$work_dir/root/funny_mystery_box" "$work_dir/root/css"
+echo "<html><body>TinyServer</body></html>" > "$work_dir/root/index.html"
+echo "<html><body>funny box</body></html>" > "$work_dir/root/funny_box.html"
+echo "body { margin: 0 }" > "$work_dir/root/css/site.css"
+head -c 4096 /dev/urandom > "$work_dir/root/funny_mystery_box/small.png"
+
+cd "$work_dir"
+"$server" -i 0 -m 1000000 $SERVER_OPTS "$port" > "$work_dir/server.log" 2>&1 &
+server_pid=$!
+trap 'kill $server_pid 2>/dev/null; wait $server_pid 2>/dev/null; rm -rf "$work_dir"' EXIT
+sleep 1
+
+urls=/,/funny_box.html,/css/site.css,/funny_mystery_box/small.png,/missing
+"$bench" -V -d "$seconds" -c 256 -t 4 -p 16 -f 7 -u "$urls" "$port"
+"$bench" -V -d "$seconds" -c 512 -t 4 -p 4 -f 1 -u "$urls" "$port"
+"$bench" -V -d "$seconds" -c 256 -t 4 -p 32 -u "$urls" "$port"
+kill -0 $server_pid || { echo "server died"; exit 1; }
@@ -0,0 +1,132 @@
+/*
+ * compare ThreadPool against the former mutex + condition_variable pool.
+ * report tasks/sec and enqueue-to-run latency percentiles.
+ *
+ * usage: threadpool_bench [task_num] [producer_num] [thread_num]
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+
+#include "common.h"
+#include "threadpool.h"
+
+static inline uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// the pool before work stealing, kept here as baseline
+class MutexThreadPool {
+public:
+    MutexThreadPool(int thread_num, int max_wait_task) : m_max_wait_task(max_wait_task), m_stop(false) {
+        for (int i = 0; i < thread_num; ++i) {
+            pthread_t thread;
+            pthread_create(&thread, nullptr, worker, this);
+            pthread_detach(thread);
+        }
+    }
+
+    bool appendTask(Runner *runner) {
+        std::lock_guard<std::mutex> g(m_queue_mutex);
+        if (m_task_queue.size() >= m_max_wait_task)
+            return false;
+        m_task_queue.push(runner);
+        m_cv.notify_one();
+        return true;
+    }
+
+private:
+    static void *worker(void *arg) {
+        auto pool = static_cast<MutexThreadPool *>(arg);
+        while (!pool->m_stop) {
+            std::unique_lock<std::mutex> lk(pool->m_queue_mutex);
+            pool->m_cv.wait(lk, [pool]() { return !pool->m_task_queue.empty(); });
+            Runner *runner = pool->m_task_queue.front();
+            pool->m_task_queue.pop();
+            lk.unlock();
+            if (runner != nullptr)
+                runner->run();
+        }
+        return pool;
+    }
+
+    size_t m_max_wait_task;
+    std::queue<Runner *> m_task_queue;
+    std::mutex m_queue_mutex;
+    std::condition_variable m_cv;
+    bool m_stop;
+};
+
+class BenchTask : public Runner {
+public:
+    void run() final {
+        *latency = nowNs() - enqueue_ns;
+        done->fetch_add(1, std::memory_order_release);
+    }
+
+    uint64_t enqueue_ns = 0;
+    uint64_t *latency = nullptr;
+    std::atomic<int> *done = nullptr;
+};
+
+template<typename Pool>
+static void bench(const char *name, Pool &pool, int task_num, int producer_num) {
+    std::vector<BenchTask> tasks(task_num);
+    std::vector<uint64_t> latency(task_num);
+    std::atomic<int> done(0);
+    for (int i = 0; i < task_num; ++i) {
+        tasks[i].latency = &latency[i];
+        tasks[i].done = &done;
+    }
+
+    uint64_t start = nowNs();
+    std::vector<std::thread> producers;
+    for (int p = 0; p < producer_num; ++p) {
+        producers.emplace_back([&, p]() {
+            for (int i = p; i < task_num; i += producer_num) {
+                tasks[i].enqueue_ns = nowNs();
+                while (!pool.appendTask(&tasks[i]))
+                    std::this_thread::yield();
+            }
+        });
+    }
+    for (auto &t : producers)
+        t.join();
+    while (done.load(std::memory_order_acquire) != task_num)
+        std::this_thread::yield();
+    uint64_t elapsed = nowNs() - start;
+
+    std::sort(latency.begin(), latency.end());
+    auto percentile = [&](double p) {
+        return latency[std::min<size_t>(task_num - 1, static_cast<size_t>(task_num * p))] / 1000.0;
+    };
+    printf("%-14s %12.0f tasks/s   p50 %9.1f us   p99 %9.1f us   p999 %9.1f us\n",
+           name, task_num * 1e9 / elapsed, percentile(0.5), percentile(0.99), percentile(0.999));
+}
+
+int main(int argc, char **argv) {
+    int task_num = argc > 1 ? atoi(argv[1]) : 1000000;
+    int producer_num = argc > 2 ? atoi(argv[2]) : 1;
+    int thread_num = argc > 3 ? atoi(argv[3]) : 16;
+    printf("tasks %d, producers %d, workers %d\n", task_num, producer_num, thread_num);
+
+    // old pool cannot be stopped cleanly, leave it running
+    auto mutex_pool = new MutexThreadPool(thread_num, 23333);
+    bench("mutex+cv", *mutex_pool, task_num, producer_num);
+
+    {
+        ThreadPool pool(thread_num, 23333);
+        bench("work-stealing", pool, task_num, producer_num);
+    }
+    return 0;
+}
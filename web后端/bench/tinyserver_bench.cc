@@ -0,0 +1,559 @@
+/*
+ * epoll based http load generator for TinyServer.
+ * every thread drives its own share of the connections, requests rotate
+ * through the url list and up to pipeline_depth requests are in flight
+ * on each connection. latency is measured from the moment a request is
+ * queued to the moment its last body byte is read.
+ *
+ * -V checks every response against the first one seen for its url
+ * (status and body length), so a response answered out of order or
+ * built from another request's bytes shows up as a mismatch. urls must
+ * then have stable, distinguishable responses (not /random_funny).
+ * -f sends requests in segments of that many bytes, so the server
+ * reads a connection again while earlier requests are still parsed.
+ *
+ * usage: tinyserver_bench [-c conns] [-t threads] [-d seconds] [-p depth]
+ *                         [-k 0|1] [-u url,url,...] [-h host] [-V] [-f bytes] port
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cerrno>
+#include <unistd.h>
+#include <strings.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+struct BenchConfig {
+    int conn_num = 64;
+    int thread_num = 1;
+    int duration = 10;
+    int pipeline_depth = 1;
+    bool keep_alive = true;
+    std::vector<std::string> urls = {"/", "/funny_box.html", "/random_funny"};
+    std::string host = "127.0.0.1";
+    int port = 0;
+    bool verify = false;
+    size_t fragment = 0;    // bytes per send(), 0 sends all at once
+};
+
+static inline uint64_t nowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+ * log-linear latency histogram in microseconds,
+ * exact below 1024us, 512 sub buckets per power of 2 above
+ */
+class Histogram {
+public:
+    Histogram() : m_buckets(1024 + 54 * 512, 0) {}
+
+    void record(uint64_t us) {
+        ++m_buckets[bucketOf(us)];
+        ++m_count;
+        m_max = std::max(m_max, us);
+    }
+
+    void merge(const Histogram &other) {
+        for (size_t i = 0; i < m_buckets.size(); ++i)
+            m_buckets[i] += other.m_buckets[i];
+        m_count += other.m_count;
+        m_max = std::max(m_max, other.m_max);
+    }
+
+    uint64_t percentile(double p) const {
+        uint64_t target = static_cast<uint64_t>(m_count * p);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < m_buckets.size(); ++i) {
+            seen += m_buckets[i];
+            if (seen > target)
+                return valueOf(i);
+        }
+        return m_max;
+    }
+
+    uint64_t count() const { return m_count; }
+    uint64_t max() const { return m_max; }
+
+private:
+    static size_t bucketOf(uint64_t us) {
+        if (us < 1024)
+            return us;
+        int e = 63 - __builtin_clzll(us);
+        return 1024 + (e - 10) * 512 + ((us >> (e - 9)) & 511);
+    }
+
+    static uint64_t valueOf(size_t ind) {
+        if (ind < 1024)
+            return ind;
+        int e = static_cast<int>((ind - 1024) / 512) + 10;
+        return (1ULL << e) + (((ind - 1024) % 512) << (e - 9));
+    }
+
+    std::vector<uint64_t> m_buckets;
+    uint64_t m_count = 0;
+    uint64_t m_max = 0;
+};
+
+struct Stats {
+    Histogram latency;
+    uint64_t responses = 0;
+    uint64_t bytes = 0;
+    uint64_t connects = 0;
+    uint64_t connect_errors = 0;
+    uint64_t io_errors = 0;         // reset or eof with requests in flight
+    uint64_t parse_errors = 0;
+    uint64_t mismatches = 0;        // -V, response differs from earlier one of same url
+    std::map<int, uint64_t> status;
+
+    void merge(const Stats &other) {
+        latency.merge(other.latency);
+        responses += other.responses;
+        bytes += other.bytes;
+        connects += other.connects;
+        connect_errors += other.connect_errors;
+        io_errors += other.io_errors;
+        parse_errors += other.parse_errors;
+        mismatches += other.mismatches;
+        for (auto &kv : other.status)
+            status[kv.first] += kv.second;
+    }
+};
+
+struct Request {
+    uint64_t queued_us;
+    size_t url;
+};
+
+struct Conn {
+    int fd = -1;
+    std::string out;                // requests not written yet
+    size_t out_ind = 0;
+    std::deque<Request> in_flight;  // every unanswered request
+    std::string in;                 // response bytes not consumed yet
+    size_t in_ind = 0;
+    bool in_body = false;
+    size_t body_size = 0;
+    size_t body_left = 0;           // chunked: of current chunk and its CRLF
+    bool chunked = false;
+    int status = 0;
+    bool server_close = false;
+    uint64_t sent = 0;
+    size_t next_url = 0;
+};
+
+class Worker {
+public:
+    Worker(const BenchConfig &config, int conn_num, int id)
+            : m_config(config), m_conns(conn_num), m_id(id) {}
+
+    void run(const std::atomic<bool> &stop);
+
+    Stats stats;
+
+private:
+    void openConn(size_t ind);
+    void closeConn(Conn &conn, bool error);
+    void fillRequests(Conn &conn);
+    bool flush(Conn &conn);
+    bool readResp(Conn &conn, bool &eof);
+    bool parseResp(Conn &conn, bool &done);
+    bool parseHead(Conn &conn, size_t end);
+
+    const BenchConfig &m_config;
+    std::vector<Conn> m_conns;
+    std::vector<std::pair<int, size_t>> m_expected;    // -V, (status, body size) per url, status 0 if unseen
+    int m_id;
+    int m_epoll_fd = -1;
+    struct sockaddr_in m_address;
+};
+
+void Worker::openConn(size_t ind) {
+    Conn &conn = m_conns[ind];
+    size_t next_url = conn.next_url ? conn.next_url : ind + m_id;
+    conn = Conn();
+    conn.next_url = next_url;
+    conn.fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (conn.fd == -1) {
+        ++stats.connect_errors;
+        return;
+    }
+    int on = 1;
+    setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    if (connect(conn.fd, reinterpret_cast<struct sockaddr *>(&m_address), sizeof(m_address)) == -1 &&
+        errno != EINPROGRESS) {
+        ++stats.connect_errors;
+        close(conn.fd);
+        conn.fd = -1;
+        return;
+    }
+    ++stats.connects;
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.u64 = ind;
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, conn.fd, &event);
+    fillRequests(conn);
+}
+
+void Worker::closeConn(Conn &conn, bool error) {
+    if (conn.fd == -1)
+        return;
+    if (error && !conn.in_flight.empty())
+        ++stats.io_errors;
+    close(conn.fd);
+    conn.fd = -1;
+}
+
+/*
+ * keep pipeline_depth requests in flight,
+ * a connection without keep-alive carries exactly one request
+ */
+void Worker::fillRequests(Conn &conn) {
+    size_t depth = m_config.keep_alive ? m_config.pipeline_depth : 1;
+    if (!m_config.keep_alive && conn.sent > 0)
+        return;
+    while (conn.in_flight.size() < depth) {
+        size_t url_ind = conn.next_url++ % m_config.urls.size();
+        const std::string &url = m_config.urls[url_ind];
+        conn.out += "GET " + url + " HTTP/1.1\r\nHost: " + m_config.host + "\r\n";
+        if (!m_config.keep_alive)
+            conn.out += "Connection: close\r\n";
+        conn.out += "\r\n";
+        conn.in_flight.push_back(Request{nowUs(), url_ind});
+        ++conn.sent;
+    }
+}
+
+bool Worker::flush(Conn &conn) {
+    while (conn.out_ind < conn.out.size()) {
+        size_t size = conn.out.size() - conn.out_ind;
+        if (m_config.fragment != 0)
+            size = std::min(size, m_config.fragment);
+        ssize_t ret = send(conn.fd, conn.out.data() + conn.out_ind, size, MSG_NOSIGNAL);
+        if (ret == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            return false;
+        }
+        conn.out_ind += ret;
+    }
+    conn.out.clear();
+    conn.out_ind = 0;
+    return true;
+}
+
+bool Worker::readResp(Conn &conn, bool &eof) {
+    char buf[64 * 1024];
+    eof = false;
+    while (true) {
+        ssize_t ret = recv(conn.fd, buf, sizeof(buf), 0);
+        if (ret == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            return false;
+        }
+        if (ret == 0) {
+            eof = true;
+            return true;
+        }
+        stats.bytes += ret;
+        // body bytes are only counted, never buffered
+        size_t skip = 0;
+        if (conn.in_body && conn.in_ind == conn.in.size()) {
+            skip = std::min(conn.body_left, static_cast<size_t>(ret));
+            conn.body_left -= skip;
+        }
+        conn.in.append(buf + skip, ret - skip);
+    }
+}
+
+/*
+ * status line and headers end at end, only status,
+ * body framing and Connection matter here
+ */
+bool Worker::parseHead(Conn &conn, size_t end) {
+    const char *head = conn.in.data() + conn.in_ind;
+    size_t size = end - conn.in_ind;
+    if (size < 12 || strncmp(head, "HTTP/1.", 7) != 0)
+        return false;
+    conn.status = atoi(head + 9);
+    conn.body_size = 0;
+    conn.body_left = 0;
+    conn.chunked = false;
+    const char *line = static_cast<const char *>(memchr(head, '\n', size));
+    while (line && line + 1 < head + size) {
+        ++line;
+        const char *line_end = static_cast<const char *>(memchr(line, '\n', head + size - line));
+        if (!line_end)
+            break;
+        if (strncasecmp(line, "Content-Length:", 15) == 0)
+            conn.body_size = conn.body_left = strtoull(line + 15, nullptr, 10);
+        else if (strncasecmp(line, "Transfer-Encoding: chunked", 26) == 0)
+            conn.chunked = true;
+        else if (strncasecmp(line, "Connection:", 11) == 0) {
+            const char *value = line + 11;
+            while (*value == ' ')
+                ++value;
+            if (strncasecmp(value, "close", 5) == 0)
+                conn.server_close = true;
+        }
+        line = line_end;
+    }
+    return true;
+}
+
+/*
+ * consume one response, done tells whether it is complete
+ */
+bool Worker::parseResp(Conn &conn, bool &done) {
+    done = false;
+    if (!conn.in_body) {
+        size_t end = conn.in.find("\r\n\r\n", conn.in_ind);
+        if (end == std::string::npos)
+            return conn.in.size() - conn.in_ind < 64 * 1024;
+        end += 4;
+        if (!parseHead(conn, end))
+            return false;
+        conn.in_ind = end;
+        conn.in_body = true;
+    }
+    while (true) {
+        size_t take = std::min(conn.body_left, conn.in.size() - conn.in_ind);
+        conn.in_ind += take;
+        conn.body_left -= take;
+        if (conn.body_left > 0 || !conn.chunked)
+            break;
+        // size line of next chunk, body ends with last chunk and CRLF (no trailers)
+        size_t line_end = conn.in.find("\r\n", conn.in_ind);
+        if (line_end == std::string::npos)
+            return conn.in.size() - conn.in_ind < 64;
+        size_t size = strtoull(conn.in.c_str() + conn.in_ind, nullptr, 16);
+        if (size == 0) {
+            if (conn.in.size() < line_end + 4)
+                return true;
+            conn.in_ind = line_end + 4;
+            conn.chunked = false;
+            break;
+        }
+        conn.in_ind = line_end + 2;
+        conn.body_size += size;
+        conn.body_left = size + 2;
+    }
+    if (conn.in_ind == conn.in.size()) {
+        conn.in.clear();
+        conn.in_ind = 0;
+    }
+    if (conn.body_left > 0 || conn.chunked)
+        return true;
+
+    conn.in_body = false;
+    done = true;
+    if (conn.in_flight.empty())
+        return false;
+    const Request &request = conn.in_flight.front();
+    stats.latency.record(nowUs() - request.queued_us);
+    if (m_config.verify) {
+        std::pair<int, size_t> &expected = m_expected[request.url];
+        if (expected.first == 0)
+            expected = {conn.status, conn.body_size};
+        else if (expected.first != conn.status || expected.second != conn.body_size)
+            ++stats.mismatches;
+    }
+    conn.in_flight.pop_front();
+    ++stats.responses;
+    ++stats.status[conn.status];
+    return true;
+}
+
+void Worker::run(const std::atomic<bool> &stop) {
+    memset(&m_address, 0, sizeof(m_address));
+    m_address.sin_family = AF_INET;
+    m_address.sin_port = htons(m_config.port);
+    inet_pton(AF_INET, m_config.host.c_str(), &m_address.sin_addr);
+
+    m_expected.assign(m_config.urls.size(), {0, 0});
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    for (size_t i = 0; i < m_conns.size(); ++i)
+        openConn(i);
+
+    struct epoll_event events[256];
+    while (!stop.load(std::memory_order_relaxed)) {
+        int num = epoll_wait(m_epoll_fd, events, 256, 100);
+        for (int i = 0; i < num; ++i) {
+            size_t ind = events[i].data.u64;
+            Conn &conn = m_conns[ind];
+            if (conn.fd == -1)
+                continue;
+            bool ok = true;
+            bool eof = false;
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP))
+                ok = readResp(conn, eof);
+            while (ok) {
+                bool done = false;
+                ok = parseResp(conn, done);
+                if (!ok)
+                    ++stats.parse_errors;
+                if (!done || conn.server_close)
+                    break;
+            }
+            if (!ok || (eof && !conn.server_close) || (events[i].events & EPOLLERR)) {
+                closeConn(conn, true);
+                openConn(ind);
+                continue;
+            }
+            if (conn.server_close && !conn.in_body) {
+                // pipelined requests behind a Connection: close are dropped by the server
+                conn.in_flight.clear();
+                closeConn(conn, false);
+                openConn(ind);
+                continue;
+            }
+            fillRequests(conn);
+            if (!flush(conn)) {
+                closeConn(conn, true);
+                openConn(ind);
+            }
+        }
+        // retry connections that could not be opened
+        for (size_t i = 0; i < m_conns.size(); ++i)
+            if (m_conns[i].fd == -1)
+                openConn(i);
+    }
+    for (auto &conn : m_conns)
+        closeConn(conn, false);
+    close(m_epoll_fd);
+}
+
+static void printUsage(const char *prog) {
+    printf("usage: %s [-c conns] [-t threads] [-d seconds] [-p pipeline_depth] "
+           "[-k 0|1] [-u url,url,...] [-h host] [-V] [-f bytes] port\n", prog);
+}
+
+static bool parseArgs(int argc, char **argv, BenchConfig &config) {
+    int opt;
+    while ((opt = getopt(argc, argv, "c:t:d:p:k:u:h:Vf:")) != -1) {
+        switch (opt) {
+            case 'c':
+                config.conn_num = atoi(optarg);
+                break;
+            case 't':
+                config.thread_num = atoi(optarg);
+                break;
+            case 'd':
+                config.duration = atoi(optarg);
+                break;
+            case 'p':
+                config.pipeline_depth = atoi(optarg);
+                break;
+            case 'k':
+                config.keep_alive = atoi(optarg) != 0;
+                break;
+            case 'u': {
+                config.urls.clear();
+                std::string list = optarg;
+                size_t begin = 0;
+                while (begin <= list.size()) {
+                    size_t end = list.find(',', begin);
+                    if (end == std::string::npos)
+                        end = list.size();
+                    if (end > begin)
+                        config.urls.push_back(list.substr(begin, end - begin));
+                    begin = end + 1;
+                }
+                break;
+            }
+            case 'h':
+                config.host = optarg;
+                break;
+            case 'V':
+                config.verify = true;
+                break;
+            case 'f':
+                config.fragment = strtoul(optarg, nullptr, 10);
+                break;
+            default:
+                return false;
+        }
+    }
+    if (optind + 1 != argc)
+        return false;
+    config.port = atoi(argv[optind]);
+    return config.port > 0 && config.conn_num > 0 && config.thread_num > 0 &&
+           config.duration > 0 && config.pipeline_depth > 0 && !config.urls.empty();
+}
+
+int main(int argc, char **argv) {
+    BenchConfig config;
+    if (!parseArgs(argc, argv, config)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    config.thread_num = std::min(config.thread_num, config.conn_num);
+
+    std::atomic<bool> stop{false};
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (int i = 0; i < config.thread_num; ++i) {
+        int conn_num = config.conn_num / config.thread_num + (i < config.conn_num % config.thread_num);
+        workers.emplace_back(new Worker(config, conn_num, i));
+    }
+
+    uint64_t begin = nowUs();
+    std::vector<std::thread> threads;
+    for (auto &worker : workers)
+        threads.emplace_back([&worker, &stop] { worker->run(stop); });
+    std::this_thread::sleep_for(std::chrono::seconds(config.duration));
+    stop.store(true);
+    for (auto &thread : threads)
+        thread.join();
+    double seconds = (nowUs() - begin) / 1e6;
+
+    Stats total;
+    for (auto &worker : workers)
+        total.merge(worker->stats);
+
+    std::string urls;
+    for (auto &url : config.urls)
+        urls += (urls.empty() ? "" : ",") + url;
+    printf("target       %s:%d  urls %s\n", config.host.c_str(), config.port, urls.c_str());
+    printf("load         %d conns  %d threads  depth %d  keep-alive %s  %.2fs\n",
+           config.conn_num, config.thread_num, config.pipeline_depth,
+           config.keep_alive ? "on" : "off", seconds);
+    printf("throughput   %.0f req/s  %.2f MB/s  (%llu responses, %llu connects)\n",
+           total.responses / seconds, total.bytes / seconds / (1024 * 1024),
+           static_cast<unsigned long long>(total.responses),
+           static_cast<unsigned long long>(total.connects));
+    printf("latency us   p50 %llu  p99 %llu  p999 %llu  max %llu\n",
+           static_cast<unsigned long long>(total.latency.percentile(0.5)),
+           static_cast<unsigned long long>(total.latency.percentile(0.99)),
+           static_cast<unsigned long long>(total.latency.percentile(0.999)),
+           static_cast<unsigned long long>(total.latency.max()));
+    printf("status      ");
+    for (auto &kv : total.status)
+        printf(" %d:%llu", kv.first, static_cast<unsigned long long>(kv.second));
+    printf("\n");
+    printf("errors       connect %llu  io %llu  parse %llu\n",
+           static_cast<unsigned long long>(total.connect_errors),
+           static_cast<unsigned long long>(total.io_errors),
+           static_cast<unsigned long long>(total.parse_errors));
+    if (config.verify) {
+        printf("verify       mismatch %llu\n", static_cast<unsigned long long>(total.mismatches));
+        if (total.mismatches != 0 || total.parse_errors != 0)
+            return 2;
+    }
+    return total.responses > 0 ? 0 : 1;
+}
@@ -0,0 +1,92 @@
+#ifndef TINYSERVER_ACCESS_LOG_H
+#define TINYSERVER_ACCESS_LOG_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+#include <pthread.h>
+
+#include "spsc_ring.h"
+
+// one request, fixed size so it is copied into ring without allocation
+struct AccessRecord {
+    static constexpr uint8_t no_method = 0xff;     // request line not parsed
+
+    int64_t time_ns;        // wall clock when response was queued
+    uint64_t bytes;         // response bytes, header included
+    uint32_t latency_us;    // request read to response queued
+    uint32_t remote_ip;     // network byte order
+    uint16_t status;
+    uint8_t method;         // HTTP_METHOD or no_method
+    uint8_t version;        // HTTP_VERSION
+    uint16_t path_size;     // truncated to sizeof(path)
+    char path[226];
+};
+
+/*
+ * asynchronous access log.
+ * every logging thread owns a SPSC ring of records, a flusher thread
+ * drains all rings periodically, formats them and writes each batch
+ * with one write(). a full ring drops the record instead of blocking.
+ * file is rotated to path.1 .. path.N when it grows past rotate size.
+ */
+class AccessLog {
+public:
+    static AccessLog &instance();
+
+    // start logging to path, throw std::runtime_error if it can not be opened
+    void open(const std::string &path, size_t rotate_size, int keep_files = 5);
+    void stop();    // write records left and join flusher
+
+    bool enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+    // producer side, fill returned record then commit.
+    // nullptr if disabled or ring of this thread is full
+    AccessRecord *claim();
+    void commit();
+
+private:
+    AccessLog();
+    ~AccessLog();
+
+    struct Ring {
+        Ring() : records(ring_capacity), dropped(0) {}
+        SpscRing<AccessRecord> records;
+        std::atomic<uint64_t> dropped;
+    };
+
+    Ring *localRing();
+    static void *flusher(void *arg);
+    void flushLoop();
+    size_t drain();     // format records of every ring into m_batch
+    void writeBatch();
+    void rotate();
+    void formatRecord(const AccessRecord &record);
+
+private:
+    static constexpr size_t ring_capacity = 2048;
+    static constexpr int flush_interval_ms = 20;
+
+    std::atomic<bool> m_enabled;
+    std::atomic<bool> m_stop;
+    pthread_t m_thread;
+
+    std::mutex m_rings_mutex;
+    std::vector<Ring *> m_rings;    // never removed, threads only come and go at startup
+    uint64_t m_reported_dropped;
+
+    std::string m_path;
+    int m_fd;
+    size_t m_file_size;
+    size_t m_rotate_size;
+    int m_keep_files;
+    std::string m_batch;
+    int64_t m_time_sec;             // second of m_time_str
+    char m_time_str[32];
+};
+
+#endif //TINYSERVER_ACCESS_LOG_H
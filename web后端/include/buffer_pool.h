@@ -0,0 +1,48 @@
+#ifndef TINYSERVER_BUFFER_POOL_H
+#define TINYSERVER_BUFFER_POOL_H
+
+#include <cstddef>
+
+/*
+ * process wide pool of io buffers in a few size classes.
+ * every thread keeps a small cache of free buffers per class,
+ * overflow goes to a shared list and then back to malloc,
+ * so memory follows the number of active conns.
+ */
+class BufferPool {
+public:
+    static constexpr int class_num = 3;
+
+    // smallest class not less than size, capacity is set to class size.
+    // return nullptr if size is larger than maxSize()
+    static char *acquire(size_t size, size_t &capacity);
+    static void release(char *buf, size_t capacity);
+    static size_t maxSize();
+    static size_t classSize(int class_ind);
+};
+
+/*
+ * growable byte buffer backed by BufferPool.
+ * memory is attached on first reserve() and grows by moving
+ * to the next size class, so content is always contiguous.
+ */
+class Buffer {
+public:
+    Buffer() = default;
+    ~Buffer();
+    Buffer(const Buffer &) = delete;
+    Buffer &operator=(const Buffer &) = delete;
+
+    bool reserve(size_t size);      // false if size exceeds largest class
+    void release();                 // give memory back to pool
+
+    char *data() const { return m_data; }
+    size_t capacity() const { return m_capacity; }
+    bool attached() const { return m_data != nullptr; }
+
+private:
+    char *m_data = nullptr;
+    size_t m_capacity = 0;
+};
+
+#endif //TINYSERVER_BUFFER_POOL_H
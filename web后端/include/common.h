@@ -1,12 +1,18 @@
 #ifndef TINYSERVER_COMMON_H
 #define TINYSERVER_COMMON_H
 
+#include <cstdint>
+
+#include <pthread.h>
+
 extern int setNonBlocking(int fd);   //设为非阻塞
-extern int addToEpoll(int epoll_fd, int fd, bool oneshot = false);   //监听
+extern int addToEpoll(int epoll_fd, int fd, uint64_t data, bool oneshot = false);   //监听, data回到event.data.u64
 extern int removeFromEpoll(int epoll_fd, int fd);  //移除
-extern int modFd(int epoll_fd, int fd, int ev);    //修改监听状态
+extern int modFd(int epoll_fd, int fd, uint64_t data, int ev);    //修改监听状态
 extern void registerSig(int sig, void (*handle)(int), bool restart = true);   //注册信号，进行监听
 extern char *int2C_string(int num, char *str);       //整数转化成字符串
+extern int createListenFd(int port, int backlog, int defer_accept, bool nodelay);    //SO_REUSEPORT监听端口, 非阻塞
+extern void pinThread(pthread_t thread, int id);    //绑定cpu核
 
 class Runner {
 public:
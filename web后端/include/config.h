@@ -0,0 +1,34 @@
+#ifndef TINYSERVER_CONFIG_H
+#define TINYSERVER_CONFIG_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// server options, filled from command line by parseConfig()
+struct ServerConfig {
+    int port = 0;
+    int idle_timeout = 60;      // seconds before an idle keep-alive conn is closed
+    int max_requests = 100;     // requests served on one conn before closing it
+    int tick_interval = 1;      // seconds between two SIGALRM timer ticks
+    int reactor_num = 1;        // event loops, each with own epoll and listen fd
+    long sendfile_threshold = 128 * 1024;   // bytes, larger files are sent by sendfile()
+    long long cache_bytes = 64 * 1024 * 1024;   // bytes of static files kept in memory
+    const char *access_log = nullptr;       // access log path, disabled if nullptr
+    long log_rotate_size = 64 * 1024 * 1024;    // bytes, access log rotated beyond it, 0 never
+    bool io_uring = false;      // io engine, io_uring or epoll
+    int backlog = 1024;         // listen backlog, capped by net.core.somaxconn
+    int defer_accept = 0;       // seconds of TCP_DEFER_ACCEPT, 0 disables
+    bool nodelay = false;       // TCP_NODELAY, inherited by accepted conns
+    int accept_budget = 64;     // conns accepted per loop iteration, rest wait for next one
+    long inline_limit = 50;     // us, epoll reactor parses cheap requests itself below it, 0 never
+    long long max_body = 16 * 1024 * 1024;  // bytes of a request body, larger gets 413
+    bool uploads = false;       // POST /upload/<name> stores bodies, anyone may write
+    // (path prefix, Cache-Control value) of static files, longest prefix wins
+    std::vector<std::pair<std::string, std::string>> cache_control;
+};
+
+extern void parseConfig(int argc, char **argv, ServerConfig &config);  //解析命令行参数
+extern void printUsage(const char *prog);
+
+#endif //TINYSERVER_CONFIG_H
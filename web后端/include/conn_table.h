@@ -0,0 +1,59 @@
+#ifndef TINYSERVER_CONN_TABLE_H
+#define TINYSERVER_CONN_TABLE_H
+
+#include <memory>
+#include <vector>
+
+#include <cstdint>
+
+#include "http_conn.h"
+
+/*
+ * conns of one event loop, in slabs allocated as concurrency grows.
+ * a conn is found by id = generation << 32 | slot index, never by fd,
+ * so fds are not bounded and a slot reused by a new conn makes ids
+ * of the old one stale. ids fit in 56 bits, loops may tag the rest.
+ * hot slot array (generation, free list) is apart from cold HttpConn.
+ * only touched by its loop thread.
+ */
+class ConnTable {
+public:
+    ConnTable();
+    ~ConnTable() = default;
+    ConnTable(const ConnTable &) = delete;
+    ConnTable &operator=(const ConnTable &) = delete;
+
+    static constexpr uint64_t id_mask = (1ULL << 56) - 1;
+    static uint32_t index(uint64_t id) { return static_cast<uint32_t>(id); }
+
+    HttpConn *acquire(uint64_t &id);    // conn of a fresh id
+    void release(uint64_t id);          // id and every copy of it go stale
+    HttpConn *find(uint64_t id) const;  // nullptr if stale
+    HttpConn *at(uint32_t index) const { return m_slots[index].conn; }
+    bool used(uint32_t index) const { return m_slots[index].used; }
+
+    uint32_t capacity() const { return static_cast<uint32_t>(m_slots.size()); }
+    size_t active() const { return m_active; }
+
+private:
+    static constexpr uint32_t slab_size = 256;
+    static constexpr uint32_t generation_mask = 0xffffff;
+    static constexpr uint32_t no_slot = 0xffffffff;
+
+    struct Slot {
+        uint32_t generation;
+        uint32_t next_free;
+        HttpConn *conn;     // in slab, address never changes
+        bool used;
+    };
+
+    void grow();
+
+private:
+    std::vector<Slot> m_slots;
+    std::vector<std::unique_ptr<HttpConn[]>> m_slabs;
+    uint32_t m_free_head;
+    size_t m_active;
+};
+
+#endif //TINYSERVER_CONN_TABLE_H
@@ -0,0 +1,136 @@
+#ifndef TINYSERVER_FILE_CACHE_H
+#define TINYSERVER_FILE_CACHE_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "http_conn.h"
+
+/*
+ * one cached static file, never changed after loaded.
+ * conn holds a shared_ptr while sending, so body and header
+ * stay valid even if the file is invalidated meanwhile.
+ * compressed variants are owned by the identity file.
+ */
+struct CachedFile {
+    CachedFile() = default;
+    ~CachedFile();
+    CachedFile(const CachedFile &) = delete;
+    CachedFile &operator=(const CachedFile &) = delete;
+
+    const std::string &header(bool keep_alive) const;
+    const std::string &notModifiedHeader(bool keep_alive) const;
+
+    std::string path;
+    char *address = nullptr;        // mmapped body, nullptr if file is empty or sent by fd
+    int fd = -1;                    // opened file for sendfile(), -1 if mmapped
+    struct stat file_stat;          // st_size is size of this variant
+    std::string header_keep_alive;  // pre-rendered status line and headers
+    std::string header_close;
+    std::string not_modified_keep_alive;    // pre-rendered 304
+    std::string not_modified_close;
+    std::string entity_headers;     // header lines 206 shares with 200, CRLF terminated
+    const char *content_type = nullptr;
+    std::string etag;               // quoted, from inode, size and mtime of identity file
+    time_t mtime = 0;               // Last-Modified, of identity file
+
+    CONTENT_ENCODING encoding = ENC_IDENTITY;
+    std::string compressed;         // body compressed at load, address points into it
+    std::unique_ptr<const CachedFile> variants[ENC_COUNT];  // nullptr if not available
+};
+
+/*
+ * shared read-mostly cache of static files keyed by path.
+ * a hit only takes a read lock, no syscall before writev.
+ * files are dropped when inotify reports them changed, and least
+ * recently used ones once more than max_files or cache_bytes are held.
+ */
+class FileCache {
+public:
+    static FileCache &instance();
+
+    /*
+     * path is relative to document root and normalized (normalizePath()).
+     * FILE_REQUEST on success, file is set to best variant in accept_encodings
+     */
+    HTTP_CODE get(const char *path, unsigned accept_encodings, std::shared_ptr<const CachedFile> &file);
+    bool contains(const char *path);    // loaded or recently missing, get() would not touch disk
+    void invalidate(const std::string &path);
+    void watch(const char *dir);    // invalidate files in dir and its subdirectories on change
+    // callback runs on watcher thread after files under prefix were invalidated
+    void onChange(const std::string &prefix, std::function<void()> callback);
+    // switch identity file to best variant in accept_encodings
+    static void selectVariant(std::shared_ptr<const CachedFile> &file, unsigned accept_encodings);
+    void setSendfileThreshold(off_t threshold);
+    void setCacheBytes(size_t bytes);   // mapped and compressed bytes kept at most
+    // (path prefix, Cache-Control value), prefix starts with '/' like a request path
+    void setCacheControl(const std::vector<std::pair<std::string, std::string>> &rules);
+    // files under prefix ('/' first) are downloads: octet-stream, Content-Disposition: attachment
+    void addAttachment(const std::string &prefix);
+
+private:
+    FileCache();
+    ~FileCache();
+
+    HTTP_CODE load(const char *path, std::shared_ptr<const CachedFile> &file);
+    HTTP_CODE loadBody(const char *path, CachedFile &file);
+    void loadVariants(const CachedFile &file, bool compressible, std::unique_ptr<CachedFile> *variants);
+    int openBeneath(const char *path) const;
+    const char *cacheControl(const std::string &path) const;
+    bool attachment(const std::string &path) const;
+    void insert(const std::shared_ptr<const CachedFile> &file);
+    void drop(const std::string &path);
+    void evict();
+    void dropChanged(const std::string &path);
+    void dropChangedDir(const std::string &prefix);
+    void watchTree(const std::string &dir);
+    static void *watcher(void *arg);
+    void watchLoop();
+
+private:
+    struct Entry {
+        Entry(std::shared_ptr<const CachedFile> file, size_t bytes, unsigned long used)
+                : file(std::move(file)), bytes(bytes), used(used) {}
+
+        std::shared_ptr<const CachedFile> file;
+        size_t bytes;                       // in memory: mapping and compressed variants
+        std::atomic<unsigned long> used;    // m_clock at last hit, least one is evicted first
+    };
+    std::unordered_map<std::string, Entry> m_files;
+    size_t m_bytes;             // sum of Entry::bytes
+    size_t m_cache_bytes;
+    std::atomic<unsigned long> m_clock;     // advanced by every insert
+    // failed lookups (404, 403) kept briefly so repeats skip the disk
+    struct Missing {
+        HTTP_CODE code;
+        time_t expires;
+    };
+    std::unordered_map<std::string, Missing> m_missing;
+    pthread_rwlock_t m_lock;    // m_files, m_bytes and m_missing
+    std::unordered_set<std::string> m_loading;  // paths a miss is loading now
+    pthread_mutex_t m_load_mutex;   // m_loading
+    pthread_cond_t m_load_cond;     // signaled when a path leaves m_loading
+    int m_root_fd;              // document root, lookups never leave it
+    bool m_openat2;             // kernel has openat2(), else openat() of a normalized path
+    std::atomic<unsigned long> m_generation;   // bumped on every invalidation
+    off_t m_sendfile_threshold;     // files not smaller than it are kept as fd
+    std::vector<std::pair<std::string, std::string>> m_cache_control;
+    std::vector<std::string> m_attachments;
+
+    int m_inotify_fd;
+    std::unordered_map<int, std::string> m_watch_dirs;  // watch fd -> path prefix, "" for root
+    std::vector<std::pair<std::string, std::function<void()>>> m_listeners;
+    pthread_mutex_t m_watch_mutex;
+    bool m_watcher_started;
+};
+
+#endif //TINYSERVER_FILE_CACHE_H
@@ -3,26 +3,29 @@
 
 #include <string>
 #include <array>
+#include <memory>
 #include <unordered_map>
-#include <regex>
-#include <random>
 
 #include <ctime>
 
-#include <dirent.h>
 #include <arpa/inet.h>
 #include <sys/uio.h>
 #include <sys/stat.h>
 
+#include "buffer_pool.h"
 #include "common.h"
+#include "http_parser.h"
+#include "response_writer.h"
+#include "timer_wheel.h"
 
 class HttpConn;
+struct CachedFile;
 
 enum LINE_STATE {
     LINE_OPEN = 0, LINE_OK, LINE_BAD,
 };
 enum HTTP_CHECK_STATE {
-    REQUEST = 0, HEADER, CONTENT    // REQ_OK, also DATA_OK
+    REQUEST = 0, HEADER, BODY, CONTENT    // REQ_OK, also DATA_OK
 };
 enum HTTP_CODE {
     NO_REQUEST = 0,
@@ -31,103 +34,197 @@ enum HTTP_CODE {
     NO_RESOURCE,
     FORBIDDEN_REQUEST,
     FILE_REQUEST,
+    CREATED,            // handler stored a resource, 201 with Location
+    NOT_MODIFIED,       // cached file matches request validators, 304
+    PARTIAL_CONTENT,    // m_ranges of cached file, 206
+    RANGE_NOT_SATISFIABLE,
+    METHOD_NOT_ALLOWED, // route has no handler for method, 405
+    CONFLICT,           // target already exists, 409
+    PAYLOAD_TOO_LARGE,  // body over max_body, 413
+    BODY_REQUEST,       // body generated into m_body, e.g. /__stats
     INTERNAL_ERROR,
     CLOSED_CONNECTION
 };
-enum CONTENT_TYPE {
-    HTML = 0, IMG_JPG, IMG_PNG,
-};
-enum HTTP_METHOD {
-    GET = 0, POST,
-};
 
 static std::unordered_map<int, const char *> status_code_map = {
         {200, "OK"},
+        {201, "Created"},
+        {206, "Partial Content"},
+        {304, "Not Modified"},
         {400, "Bad Request"},
         {403, "Forbidden"},
         {404, "Not Found"},
+        {405, "Method Not Allowed"},
+        {409, "Conflict"},
+        {413, "Content Too Large"},
+        {416, "Range Not Satisfiable"},
         {500, "Internal Server Error"}
 };
 
+/*
+ * event loop serving a conn (epoll Reactor or UringReactor).
+ * HttpConn only tells it what to wait for next,
+ * so parse and response code is shared by both engines.
+ */
+class ConnLoop {
+public:
+    virtual ~ConnLoop() = default;
+
+    virtual void waitRead(HttpConn *conn) = 0;     // all responses sent, wait for request
+    virtual void waitWrite(HttpConn *conn) = 0;    // responses queued
+    virtual void dropConn(HttpConn *conn) = 0;     // close conn, e.g. on idle timeout
+    virtual void dispatch(HttpConn *conn) = 0;     // requests in read buffer, run() inline or elsewhere
+    virtual void wakeStream(uint64_t conn_id) = 0; // any thread: stalled stream has more, stale id ignored
+};
 
-static std::regex req_re("^(GET|POST)\\s([^\\s]+)\\s(HTTP\\/1\\.1)$", std::regex::icase);
-static std::default_random_engine file_no_e(time(nullptr));
-static std::uniform_int_distribution<int> distribution(0, 0x7fffffff);
+/*
+ * epoll Reactor bookkeeping of a conn run by a ThreadPool worker,
+ * intrusive like TimerNode so handing it back allocates nothing
+ */
+struct OffloadNode {
+    OffloadNode *offload_next = nullptr;    // Reactor hand back stack
+    uint32_t offload_ev = 0;        // events to re-arm once handed back
+    bool offloaded = false;         // a worker owns conn, loop thread only
+};
 
 // http conn class
-class HttpConn : public Runner {
+class HttpConn : public Runner, public TimerNode, public OffloadNode {
 public:
     // class interface
     HttpConn();
     ~HttpConn() = default;
 
-    void init(int remote_fd, const sockaddr_in &address, int epoll_fd);
+    void init(int remote_fd, const sockaddr_in &address, ConnLoop *loop, uint64_t conn_id);
     void closeConn();
+    int fd() const { return m_remote_fd; }
+    uint64_t connId() const { return m_conn_id; }   // ConnTable id, tags loop events
 
     bool readReqToBuf();    // read http request from client
+    bool splicing() const { return m_body_splice; }    // body still going to file in kernel
     bool prepareWrite(HTTP_CODE http_code);
     bool writeResp();
+    void rejectOverload();  // canned 503, conn is closed after
+    bool cheapRequest() const;  // run() is fast enough for loop thread
+
+    // completion based engine, it does the io and reports bytes moved
+    bool appendReq(const char *data, size_t size);  // bytes received
+    size_t readSpace();     // bytes appendReq() can take now
+    bool writePending() { return m_writer.pending(); }
+    bool keepAfterWrite() const { return !m_close_after_write; }
+    bool fileBodyNext() const { return m_writer.fileNext(); }  // next bytes go by sendfile()
+    bool writeStalled() const { return m_writer.stalled(); }   // stream has nothing to send yet
+    int buildWriteVec(bool &more);  // gather mapped bytes into writeVec()
+    const struct iovec *writeVec() const { return m_writer.vec(); }
+    ssize_t sendFileBody();
+    void consumeSent(ssize_t bytes);
+    bool finishWrite();     // every response sent, false if conn should be closed
 
     void run() final;       // parse http request in buffer
-    static void addResourceFile(const char *filename);
+    void onTimeout() final; // idle keep-alive conn expired
+    // response of current request, called by route handlers (see router.h)
+    HTTP_CODE respondFile(const char *filename);    // normalized path under root
+    HTTP_CODE respondCached(std::shared_ptr<const CachedFile> file);
+    HTTP_CODE respondBody(std::string body, const char *content_type);
+    ResponseBody &respondWith(const char *content_type);    // fill body, return BODY_REQUEST
+    // call from any thread once a stream source that had nothing has more, see BodySource
+    std::function<void()> streamWaker() const;
+    HTTP_CODE respondCreated(std::string location);
+    // called by a route body handler before body is read: body goes to new file at path,
+    // removed again unless the request completes and its handler takes it
+    HTTP_CODE receiveBodyTo(const std::string &path);
+    std::string takeBodyFile();     // path of complete body, now owned by caller, empty if none
+
+    static void setMaxRequests(int max_requests);
+    static void setMaxBody(int64_t max_body);
     static void prepareResource();
 
 private:
     // http common function
     void init();
+    void resetRequest();
+    void processRequests();
     HTTP_CODE parseReq();
     LINE_STATE parseLine();
     HTTP_CODE parseReqLine(char *line);
     HTTP_CODE parseHeaders(char *line);
+    HTTP_CODE beginBody();
+    HTTP_CODE parseBody();
+    bool storeBody(const char *data, size_t size);
+    bool spliceBody();
+    HTTP_CODE beginRoute();
+    void releaseBody();
     HTTP_CODE parseContent();
     HTTP_CODE prepareFile(const char *filename);
+    HTTP_CODE prepareCachedFile();
+    HTTP_CODE prepareRange();
+    unsigned acceptEncodings() const;
+    bool queueRanges();
     inline char *getLine();
 
-    void addCRLF();
-    void addStatusLine(const char *version, const char *status_code);
-    void addHeader(const char *key, const char *value);
-
 private:
     // response common function
-    void unmap();
+    void releaseFile();
+    void releaseBuffers();
+    void logRequest(int status, ssize_t bytes);
+    ssize_t sendVec();
+    void compactReadBuf();
 
 private:
     // http common information
-    int m_epoll_fd;
+    ConnLoop *m_loop;
     int m_remote_fd;
-
-    // must take sure that big enough read buffer size.
-    static constexpr int read_buf_size = 2048;
-    static constexpr int write_buf_size = 2048;
-
-    // store complete http request
-    char m_read_buf[read_buf_size];
-    char m_write_header_buf[write_buf_size];
-    int m_header_size;
-    char *m_file_address;
-    struct stat m_file_stat;
-    struct iovec m_write_vec[2];
-
+    uint64_t m_conn_id;
+    uint32_t m_remote_ip;   // network byte order, for access log
+    uint64_t m_read_ns;     // last read with data, requests in it arrived then
+
+    // store complete http request, taken from BufferPool on first read
+    // and given back when conn is idle or closed
+    Buffer m_read_buf;
+    std::shared_ptr<const CachedFile> m_file;   // file of request being parsed
+    ResponseBody m_body;            // generated body of request being parsed
+    const char *m_body_type;
+    static constexpr int max_ranges = 8;    // more are answered by whole file
+    ByteRange m_ranges[max_ranges];         // Range of request being parsed
+    int m_range_count;
+    unsigned m_allow;       // methods of path for 405, 1 << HTTP_METHOD
+
+    // responses of pipelined requests, sent in order
+    static constexpr int max_pipeline = 16;
+    ResponseWriter m_writer;
+    int m_resp_count;       // queued since queue was last empty
+    bool m_close_after_write;
+
+    ssize_t m_req_start;    // index where current request starts
     ssize_t m_line_ind;     // index point to line
     ssize_t m_read_ind;     // index where read buffer has been checked
     ssize_t m_read_end;     // index which points to end of read buffer
-    int m_write_vec_count;
-    ssize_t m_byte_to_send;
-    ssize_t m_byte_have_send;
 
 private:
     // header information
-    char *m_http_method;
-    char *m_src_path;
-    char *m_http_version;
-    CONTENT_TYPE m_content_type;
+    HTTP_METHOD m_http_method;
+    ssize_t m_src_path_ind; // NUL terminated path in m_read_buf
+    HTTP_VERSION m_http_version;
 
-    int m_content_length;
-    // std::regex req_re;
+    HeaderTable m_headers;
+    bool m_keep_alive;
+    int m_request_count;    // requests served on this conn
 
     HTTP_CHECK_STATE m_check_state;
 
-    static std::vector<std::string> resource_filename;
+private:
+    // request body, read across reads in BODY state
+    int64_t m_content_length;   // Content-Length bytes not read yet
+    bool m_chunked;
+    ChunkDecoder m_chunk_decoder;
+    int64_t m_body_size;        // body bytes received
+    bool m_body_splice;         // epoll: rest of body goes socket -> pipe -> file in kernel
+    int m_splice_pipe[2];
+    int m_body_fd;              // -1 if body is discarded
+    std::string m_body_path;    // file of m_body_fd, removed if request does not complete
+    std::string m_location;     // of a 201
+
+    static int max_requests;
+    static int64_t max_body;
 };
 
 #endif //TINYSERVER_HTTP_CONN_H
@@ -0,0 +1,176 @@
+#ifndef TINYSERVER_HTTP_PARSER_H
+#define TINYSERVER_HTTP_PARSER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+enum HTTP_METHOD {
+    GET = 0, POST, HEAD, PUT, DELETE, CONNECT, OPTIONS, TRACE, PATCH,
+};
+enum HTTP_VERSION {
+    HTTP_1_0 = 0, HTTP_1_1,
+};
+
+// slice of request buffer, not owning and not NUL terminated
+struct StrView {
+    const char *data;
+    size_t size;
+};
+
+// headers kept in HeaderTable, others are skipped
+enum HEADER_ID {
+    HDR_HOST = 0,
+    HDR_CONNECTION,
+    HDR_CONTENT_LENGTH,
+    HDR_TRANSFER_ENCODING,
+    HDR_ACCEPT_ENCODING,
+    HDR_IF_NONE_MATCH,
+    HDR_IF_MODIFIED_SINCE,
+    HDR_RANGE,
+    HDR_IF_RANGE,
+    HDR_USER_AGENT,
+    HDR_EXPECT,
+    HDR_COUNT,      // also means unknown header
+};
+
+// content codings a static file may be stored in, bit i of an accept mask
+enum CONTENT_ENCODING {
+    ENC_IDENTITY = 0, ENC_GZIP, ENC_BR, ENC_COUNT,
+};
+
+enum SCAN_LEVEL {
+    SCAN_SCALAR = 0, SCAN_SSE2, SCAN_AVX2,
+};
+
+/*
+ * header values as offsets into request buffer,
+ * so they stay valid when the buffer moves.
+ */
+struct HeaderTable {
+    struct Slice {
+        int32_t offset;     // -1 if header absent
+        int32_t size;
+    };
+
+    void clear();
+    bool has(HEADER_ID id) const { return slices[id].offset >= 0; }
+    void set(HEADER_ID id, int32_t offset, int32_t size);
+    void shift(int32_t delta);      // buffer content moved by delta
+
+    Slice slices[HDR_COUNT];
+};
+
+struct RequestLine {
+    HTTP_METHOD method;
+    StrView target;
+    HTTP_VERSION version;
+};
+
+/*
+ * single pass request line tokenizer, no allocation.
+ * accept "METHOD SP request-target SP HTTP/1.x" without CRLF,
+ * target points into line.
+ * return false if line is malformed.
+ */
+extern bool parseRequestLine(const char *line, size_t size, RequestLine &req_line);
+
+/*
+ * find first byte equal to a or b in [begin, end), end if none.
+ * scans 16 or 32 bytes at a time, implementation picked at startup
+ * by cpu feature (AVX2, SSE2, or scalar fallback).
+ */
+extern const char *findAnyOf2(const char *begin, const char *end, char a, char b);
+extern SCAN_LEVEL scanLevel();
+extern bool setScanLevel(SCAN_LEVEL level);     // false if cpu lacks it
+extern const char *scanLevelName(SCAN_LEVEL level);
+
+// method token, e.g. "GET"
+extern const char *methodName(HTTP_METHOD method);
+
+// case insensitive match of known header name, HDR_COUNT if unknown
+extern HEADER_ID matchHeaderName(const char *name, size_t size);
+
+/*
+ * codings of an Accept-Encoding value as mask of 1 << CONTENT_ENCODING,
+ * "x;q=0" excludes x, "*" stands for every coding not listed.
+ * identity is always set.
+ */
+extern unsigned parseAcceptEncoding(const char *value, size_t size);
+
+/*
+ * true if If-None-Match value lists etag or is "*",
+ * weak comparison: W/ prefixes are ignored.
+ */
+extern bool matchETag(const char *value, size_t size, const char *etag, size_t etag_size);
+
+// inclusive byte range of a representation
+struct ByteRange {
+    int64_t first;
+    int64_t last;
+};
+
+enum RANGE_RESULT {
+    RANGE_IGNORE = 0,       // malformed, other unit or too many ranges, send whole
+    RANGE_OK,
+    RANGE_UNSATISFIABLE,    // 416
+};
+
+/*
+ * parse Range value "bytes=0-99, 200-, -50" against length.
+ * satisfiable ranges go to ranges clipped to length, in order of
+ * offset, overlapping or adjacent ones coalesced.
+ */
+extern RANGE_RESULT parseRange(const char *value, size_t size, int64_t length,
+                               ByteRange *ranges, int max_ranges, int &count);
+
+// IMF-fixdate ("Sun, 06 Nov 1994 08:49:37 GMT") as unix time, -1 if malformed
+extern time_t parseHttpDate(const char *value, size_t size);
+
+// Content-Length value, only digits allowed, -1 if malformed or absurd
+extern int64_t parseContentLength(const char *value, size_t size);
+
+/*
+ * incremental Transfer-Encoding: chunked decoder, input may be cut
+ * anywhere. chunk extensions and trailers are skipped.
+ */
+class ChunkDecoder {
+public:
+    ChunkDecoder() { reset(); }
+
+    void reset();
+    bool done() const { return m_state == CHUNK_DONE; }
+    bool bad() const { return m_state == CHUNK_BAD; }
+
+    /*
+     * decode data[0, size), chunk data is moved in place to data[0, out_size).
+     * return bytes consumed, less than size only if body ended there.
+     */
+    size_t decode(char *data, size_t size, size_t &out_size);
+
+private:
+    enum CHUNK_STATE {
+        CHUNK_SIZE = 0, CHUNK_EXT, CHUNK_SIZE_LF, CHUNK_DATA, CHUNK_DATA_CR, CHUNK_DATA_LF,
+        CHUNK_TRAILER, CHUNK_TRAILER_LINE, CHUNK_END_LF, CHUNK_DONE, CHUNK_BAD,
+    };
+
+    CHUNK_STATE m_state;
+    int64_t m_remaining;    // chunk size being read, then data bytes left
+    int m_digits;
+};
+
+enum PATH_RESULT {
+    PATH_OK = 0,
+    PATH_BAD,           // malformed %XX, encoded '/' or NUL, too long
+    PATH_FORBIDDEN,     // climbs above root or names a dot file
+};
+
+/*
+ * request path (query split off) to a path relative to document root
+ * in out, NUL terminated: %XX decoded, empty and "." segments dropped,
+ * ".." resolved. a directory path gets index_name appended.
+ */
+extern PATH_RESULT normalizePath(const char *path, size_t size, const char *index_name,
+                                 char *out, size_t out_size);
+
+#endif //TINYSERVER_HTTP_PARSER_H
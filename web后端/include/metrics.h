@@ -0,0 +1,132 @@
+#ifndef TINYSERVER_METRICS_H
+#define TINYSERVER_METRICS_H
+
+#include <atomic>
+#include <string>
+
+#include <cstdint>
+#include <ctime>
+
+enum METRIC_COUNTER {
+    CNT_ACCEPT = 0,         // conns accepted
+    CNT_ACCEPT_DROP,        // conns refused, no room for them
+    CNT_CLOSE,              // conns closed
+    CNT_READ_BYTES,
+    CNT_WRITE_BYTES,
+    CNT_REQUEST,            // responses queued
+    CNT_TASK_REJECT,        // ThreadPool queues full
+    CNT_LOG_DROP,           // access log records dropped, ring full
+    CNT_SYSCALL,            // syscalls on io path of both engines
+    CNT_STALE_EVENT,        // events for a conn already closed
+    CNT_INLINE_RUN,         // reads parsed and answered on loop thread
+    CNT_OFFLOAD_RUN,        // reads handed to ThreadPool
+    CNT_COUNT
+};
+enum METRIC_HISTOGRAM {
+    HIST_QUEUE_WAIT = 0,    // appendTask() to run() of a task
+    HIST_PARSE,             // parse and route requests in HttpConn::run()
+    HIST_WRITE,             // one HttpConn::writeResp() call
+    HIST_COUNT
+};
+// last value set by a thread, reported as max over threads
+enum METRIC_GAUGE {
+    GAUGE_INLINE_COST = 0,  // moving average of one inline run, ns
+    GAUGE_INLINE_LIMIT,     // inline runs stop while cost is above it, ns
+    GAUGE_COUNT
+};
+
+/*
+ * counters of one thread, only written by its owner.
+ * a plain load and store is enough for single writer,
+ * readers aggregate with relaxed loads at any time.
+ */
+struct alignas(64) ThreadMetrics {
+    static constexpr int bucket_num = 64;   // bucket i holds [2^i, 2^(i+1)) ns
+    static constexpr int min_status = 100;
+    static constexpr int max_status = 600;
+
+    struct Histogram {
+        std::atomic<uint64_t> buckets[bucket_num];
+        std::atomic<uint64_t> sum;
+    };
+
+    std::atomic<uint64_t> counters[CNT_COUNT];
+    Histogram histograms[HIST_COUNT];
+    std::atomic<uint64_t> status[max_status - min_status];
+    std::atomic<uint64_t> gauges[GAUGE_COUNT];
+};
+
+/*
+ * process wide metrics, per thread slots are created on first use
+ * and kept after thread exit, so nothing is lost from totals.
+ * render*() sums every slot on demand.
+ */
+class Metrics {
+public:
+    static inline void add(METRIC_COUNTER counter, uint64_t n = 1);
+    static inline void record(METRIC_HISTOGRAM histogram, uint64_t ns);
+    static inline void addStatus(int code);
+    static inline void set(METRIC_GAUGE gauge, uint64_t value);
+    static inline uint64_t nowNs();
+
+    static std::string renderJson();
+    static std::string renderPrometheus();
+
+private:
+    static inline ThreadMetrics &local();
+    static ThreadMetrics *attach();
+
+    static inline void bump(std::atomic<uint64_t> &value, uint64_t n) {
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+};
+
+inline ThreadMetrics &Metrics::local() {
+    static thread_local ThreadMetrics *metrics = nullptr;
+    if (metrics == nullptr)
+        metrics = attach();
+    return *metrics;
+}
+
+inline void Metrics::add(METRIC_COUNTER counter, uint64_t n) {
+    bump(local().counters[counter], n);
+}
+
+inline void Metrics::record(METRIC_HISTOGRAM histogram, uint64_t ns) {
+    ThreadMetrics::Histogram &h = local().histograms[histogram];
+    int bucket = ns == 0 ? 0 : 63 - __builtin_clzll(ns);
+    bump(h.buckets[bucket], 1);
+    bump(h.sum, ns);
+}
+
+inline void Metrics::addStatus(int code) {
+    if (code >= ThreadMetrics::min_status && code < ThreadMetrics::max_status)
+        bump(local().status[code - ThreadMetrics::min_status], 1);
+}
+
+inline void Metrics::set(METRIC_GAUGE gauge, uint64_t value) {
+    local().gauges[gauge].store(value, std::memory_order_relaxed);
+}
+
+inline uint64_t Metrics::nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * record time spent in a scope into histogram
+ */
+class ScopedTimer {
+public:
+    explicit ScopedTimer(METRIC_HISTOGRAM histogram) : m_histogram(histogram), m_begin(Metrics::nowNs()) {}
+    ~ScopedTimer() { Metrics::record(m_histogram, Metrics::nowNs() - m_begin); }
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+    METRIC_HISTOGRAM m_histogram;
+    uint64_t m_begin;
+};
+
+#endif //TINYSERVER_METRICS_H
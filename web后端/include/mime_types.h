@@ -0,0 +1,17 @@
+#ifndef TINYSERVER_MIME_TYPES_H
+#define TINYSERVER_MIME_TYPES_H
+
+struct MimeType {
+    const char *extension;  // lower case, without dot
+    const char *type;       // Content-Type value
+    bool compressible;      // text like, worth gzip / br when cached
+};
+
+/*
+ * type of path by its extension (case insensitive), application/octet-stream
+ * if unknown. a perfect hash over the extensions is found at compile time,
+ * so a lookup is one hash and one compare.
+ */
+extern const MimeType &mimeType(const char *path);
+
+#endif //TINYSERVER_MIME_TYPES_H
@@ -0,0 +1,104 @@
+#ifndef TINYSERVER_MPMC_QUEUE_H
+#define TINYSERVER_MPMC_QUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+
+/*
+ * bounded multi producer multi consumer queue (Dmitry Vyukov's design).
+ * every cell has a sequence number telling whether it is ready
+ * for push or pop, so push and pop only need one CAS on success.
+ * capacity is rounded up to power of 2.
+ */
+template<typename T>
+class MpmcQueue {
+public:
+    explicit MpmcQueue(size_t capacity);
+    ~MpmcQueue() = default;
+
+    MpmcQueue(const MpmcQueue &) = delete;
+    MpmcQueue &operator=(const MpmcQueue &) = delete;
+
+    bool push(const T &data);
+    bool pop(T &data);
+    bool empty() const;
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+    static constexpr size_t cache_line_size = 64;
+
+    std::unique_ptr<Cell[]> m_buffer;
+    size_t m_mask;
+    alignas(cache_line_size) std::atomic<size_t> m_enqueue_pos;
+    alignas(cache_line_size) std::atomic<size_t> m_dequeue_pos;
+};
+
+template<typename T>
+MpmcQueue<T>::MpmcQueue(size_t capacity) : m_enqueue_pos(0), m_dequeue_pos(0) {
+    size_t size = 2;
+    while (size < capacity)
+        size <<= 1;
+    m_buffer.reset(new Cell[size]);
+    m_mask = size - 1;
+    for (size_t i = 0; i < size; ++i)
+        m_buffer[i].seq.store(i, std::memory_order_relaxed);
+}
+
+template<typename T>
+bool MpmcQueue<T>::push(const T &data) {
+    size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true) {
+        cell = &m_buffer[pos & m_mask];
+        size_t seq = cell->seq.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if (diff == 0) {
+            if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            // full
+            return false;
+        } else {
+            pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    cell->data = data;
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+template<typename T>
+bool MpmcQueue<T>::pop(T &data) {
+    size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true) {
+        cell = &m_buffer[pos & m_mask];
+        size_t seq = cell->seq.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+        if (diff == 0) {
+            if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            // empty
+            return false;
+        } else {
+            pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    data = cell->data;
+    cell->seq.store(pos + m_mask + 1, std::memory_order_release);
+    return true;
+}
+
+template<typename T>
+bool MpmcQueue<T>::empty() const {
+    return m_enqueue_pos.load(std::memory_order_acquire) ==
+           m_dequeue_pos.load(std::memory_order_acquire);
+}
+
+#endif //TINYSERVER_MPMC_QUEUE_H
@@ -0,0 +1,102 @@
+#ifndef TINYSERVER_REACTOR_H
+#define TINYSERVER_REACTOR_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <pthread.h>
+
+#include "config.h"
+#include "conn_table.h"
+#include "http_conn.h"
+#include "timer_wheel.h"
+
+class ThreadPool;
+
+/*
+ * io engine thread, main thread drives it by notify()
+ */
+class EventLoop {
+public:
+    // events sent to loop by notify()
+    static constexpr uint64_t EV_TICK = 1;
+    static constexpr uint64_t EV_STOP = 2;
+    static constexpr uint64_t EV_HANDBACK = 4;  // ThreadPool worker returned conns
+    static constexpr uint64_t EV_WAKE = 8;      // stalled streams have more
+
+    virtual ~EventLoop() = default;
+
+    virtual void start() = 0;       // run loop in a new thread
+    virtual void join() = 0;
+    virtual void notify(uint64_t ev) = 0;   // async safe, wake up loop
+};
+
+/*
+ * one event loop with its own epoll instance, listen fd and timer wheel.
+ * every reactor listens on the same port with SO_REUSEPORT,
+ * kernel spreads new conns among them, and a conn is served
+ * by the reactor accepted it for its whole life.
+ * conns live in the reactor's own ConnTable, epoll events carry
+ * conn id, so an event queued before its conn closed is skipped.
+ *
+ * conn fds are EPOLLONESHOT: a delivered event disarms the fd, so one
+ * thread owns a conn until it is re-armed. the loop thread re-arms
+ * itself; a ThreadPool worker pushes conn on m_handback instead and
+ * the loop re-arms it. epoll_ctl, timer and close of a conn thus
+ * only happen on the loop thread, and a conn is never read while a
+ * worker parses it.
+ */
+class Reactor : public EventLoop, public ConnLoop {
+public:
+    Reactor(int id, const ServerConfig &config, ThreadPool &thread_pool);
+    ~Reactor() override;
+
+    void start() override;
+    void join() override;
+    void notify(uint64_t ev) override;
+
+    void waitRead(HttpConn *conn) override;
+    void waitWrite(HttpConn *conn) override;
+    void dropConn(HttpConn *conn) override;
+    void dispatch(HttpConn *conn) override;     // inline or ThreadPool
+    void wakeStream(uint64_t conn_id) override;
+
+private:
+    static void *worker(void *arg);
+    void loop();
+    void handleAccept();
+    bool shedAccept();      // refuse one conn when out of fds
+    void handleNotify();
+    void closeUser(HttpConn *conn);
+    void rearm(HttpConn *conn, uint32_t ev);
+    void takeBack();    // re-arm conns workers handed back
+    void resumeStreams();   // write conns woken by wakeStream()
+
+private:
+    int m_id;
+    const ServerConfig &m_config;
+    ThreadPool &m_thread_pool;
+    ConnTable m_conns;
+
+    int m_listen_fd;
+    int m_epoll_fd;
+    int m_event_fd;     // wake up fd for notify()
+    int m_reserve_fd;   // spare fd given up to refuse conns when out of fds
+    pthread_t m_thread;
+    bool m_accept_pending;      // listen fd ready, or accept budget used up
+    static constexpr unsigned probe_interval = 16;
+    uint64_t m_inline_limit_ns;     // 0 sends every request to ThreadPool
+    uint64_t m_inline_cost_ns;      // moving average of one inline run
+    unsigned m_inline_probe;
+
+    TimerWheel m_timer_wheel;   // close idle keep-alive conn
+    int m_idle_ticks;
+    std::atomic<uint64_t> m_pending_ev;
+    std::atomic<OffloadNode *> m_handback;  // lock free stack, pushed by workers
+    std::vector<uint64_t> m_wakeups;    // conn ids from wakeStream()
+    pthread_mutex_t m_wakeup_mutex;
+    bool m_stop;
+};
+
+#endif //TINYSERVER_REACTOR_H
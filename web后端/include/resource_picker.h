@@ -0,0 +1,49 @@
+#ifndef TINYSERVER_RESOURCE_PICKER_H
+#define TINYSERVER_RESOURCE_PICKER_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "file_cache.h"
+
+/*
+ * random pick of a file in one directory (/random_funny).
+ * readers see an immutable table of cached files, a reload builds a
+ * new one and swaps it in (RCU): the old table is freed once no
+ * reader is inside pick() any more. a pick takes no lock, allocates
+ * nothing and draws from a per-thread xorshift generator.
+ */
+class ResourcePicker {
+public:
+    static ResourcePicker &instance();
+
+    // build table of dir and swap it in, false if dir can not be read
+    bool load(const std::string &dir);
+    // identity file of a random entry, false if table is empty
+    bool pick(std::shared_ptr<const CachedFile> &file);
+
+private:
+    ResourcePicker();
+    ~ResourcePicker();
+
+    struct Table {
+        std::vector<std::shared_ptr<const CachedFile>> files;
+    };
+
+    // one per reader thread, set while thread may hold a table pointer
+    struct alignas(64) Reader {
+        std::atomic<bool> active{false};
+    };
+
+    Reader *localReader();
+
+private:
+    std::atomic<const Table *> m_table;
+    std::mutex m_mutex;     // reloads and reader registration
+    std::vector<Reader *> m_readers;    // never removed, threads only come and go at startup
+};
+
+#endif //TINYSERVER_RESOURCE_PICKER_H
@@ -0,0 +1,148 @@
+#ifndef TINYSERVER_RESPONSE_WRITER_H
+#define TINYSERVER_RESPONSE_WRITER_H
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "buffer_pool.h"
+
+struct CachedFile;
+
+/*
+ * next piece of a body of unknown length appended to chunk, false once body is complete.
+ * nothing appended but true: nothing ready yet, conn waits until the
+ * source calls HttpConn::streamWaker() it was given, then pulls again.
+ */
+using BodySource = std::function<bool(std::string &chunk)>;
+
+enum SEGMENT_KIND {
+    SEG_HEADER = 0,     // bytes in header buffer of writer
+    SEG_MEMORY,         // bytes kept alive by file: pre-rendered header, mmapped body
+    SEG_OWNED,          // std::string moved in, e.g. generated body, chunk framing
+    SEG_FILE,           // sendfile() from fd of a cached file or given by a handler
+};
+
+// piece of a queued response, sent in queue order
+struct Segment {
+    SEGMENT_KIND kind;
+    const char *address;    // SEG_MEMORY
+    off_t offset;           // SEG_HEADER in header buffer, SEG_FILE in file
+    size_t size;
+    size_t sent;
+    std::shared_ptr<const CachedFile> file;     // keeps address or fd valid
+    std::string bytes;      // SEG_OWNED
+    int fd;                 // SEG_FILE
+    bool own_fd;            // given by a handler, closed once sent or dropped
+};
+
+/*
+ * body of a generated response, filled by a route handler through
+ * HttpConn::respondWith(). known size segments go out with Content-Length;
+ * stream() makes the length unknown, body is then sent chunked
+ * (HTTP/1.0: delimited by close), the source pulled as socket drains.
+ */
+class ResponseBody {
+public:
+    ResponseBody() = default;
+    ~ResponseBody();
+    ResponseBody(const ResponseBody &) = delete;
+    ResponseBody &operator=(const ResponseBody &) = delete;
+
+    void append(std::string bytes);
+    void appendFile(std::shared_ptr<const CachedFile> file, off_t offset, size_t size);
+    void appendFd(int fd, off_t offset, size_t size);  // fd is closed after
+    void stream(BodySource source);     // rest of body, after appended segments
+
+    size_t size() const { return m_size; }  // bytes of appended segments
+    bool streamed() const { return static_cast<bool>(m_source); }
+    void clear();
+
+private:
+    friend class ResponseWriter;
+    std::vector<Segment> m_segs;
+    size_t m_size = 0;
+    BodySource m_source;
+};
+
+/*
+ * send queue of a conn. headers of pipelined responses are written with
+ * an append cursor into one pooled buffer, bodies queue behind them as
+ * segments, sent in order: up to IOV_MAX of them gathered into one writev,
+ * a SEG_FILE by sendfile(). a stream is pulled only while less than
+ * stream_window bytes are queued, so after EAGAIN nothing is generated
+ * until the socket drains, the source runs no faster than client reads.
+ */
+class ResponseWriter {
+public:
+    static constexpr size_t stream_window = 64 * 1024;
+
+    // queue state between two responses, see rollback()
+    struct Mark {
+        size_t segs;
+        size_t tail_size;   // of last segment, a header may be extended in place
+        size_t cursor;
+        size_t queued;
+    };
+
+    ResponseWriter() = default;
+    ~ResponseWriter();
+    ResponseWriter(const ResponseWriter &) = delete;
+    ResponseWriter &operator=(const ResponseWriter &) = delete;
+
+    // header of next response at append cursor, "HTTP/1.1 <code> <reason>"
+    bool headerFits(size_t size) const;
+    void beginHeader(const char *status_code, const char *reason);
+    void addHeader(const char *key, const char *value);
+    void addHeader(const char *key, long long value);
+    void addLines(const std::string &lines);    // CRLF terminated header lines
+    bool endHeader();       // blank line, false if header buffer overflowed
+
+    // segments behind last header
+    bool queueCopy(const char *bytes, size_t size);     // small, into header buffer
+    void queueMemory(const char *address, size_t size, std::shared_ptr<const CachedFile> file);
+    void queueFile(std::shared_ptr<const CachedFile> file, off_t offset, size_t size);
+    void queueBody(ResponseBody &body, bool chunked);
+    Mark mark() const;
+    void rollback(const Mark &mark);    // drop what was queued after mark, before any stream
+
+    bool streaming() const { return static_cast<bool>(m_source); }
+    bool stalled() const { return m_source && m_segs.empty(); }    // source had nothing yet
+    size_t queuedBytes() const { return m_queued; }
+    bool pending();         // pulls stream when queue runs low
+    bool fileNext() const;  // front segment goes by sendFile()
+    int buildVec(bool &more);
+    const struct iovec *vec() const { return m_vec.data(); }
+    ssize_t sendFile(int sock_fd);
+    void consume(size_t bytes);
+    void reset();
+
+private:
+    void append(const char *bytes, size_t size);
+    bool closeHeader();
+    void push(Segment &&seg);
+    void pushOwned(std::string bytes);
+    void popFront();
+    void pull();
+
+private:
+    Buffer m_header_buf;
+    size_t m_cursor = 0;        // end of bytes in header buffer
+    size_t m_flushed = 0;       // bytes before it are in segments
+    bool m_overflow = false;
+
+    std::deque<Segment> m_segs;     // push_back keeps addresses, iovec stay valid
+    size_t m_queued = 0;            // unsent bytes in m_segs
+    std::vector<struct iovec> m_vec;
+
+    BodySource m_source;        // stream of last queued response, empty if none
+    bool m_chunked = false;
+    bool m_chunk_open = false;  // a chunk was framed, next one starts with CRLF
+};
+
+#endif //TINYSERVER_RESPONSE_WRITER_H
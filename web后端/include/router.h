@@ -0,0 +1,100 @@
+#ifndef TINYSERVER_ROUTER_H
+#define TINYSERVER_ROUTER_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "http_conn.h"
+#include "http_parser.h"
+
+struct RouteMatch;
+
+// build response of a matched request through HttpConn::respond*()
+using RouteHandler = std::function<HTTP_CODE(HttpConn &conn, const RouteMatch &match)>;
+
+struct Route {
+    std::string pattern;
+    RouteHandler handler;
+    const char *file;       // static file the handler serves, nullptr if none
+    bool offload;           // too slow for an epoll reactor to run inline
+    RouteHandler body;      // runs before body is read, may store it (receiveBodyTo()), else discarded
+};
+
+enum ROUTE_RESULT {
+    ROUTE_FOUND = 0,
+    ROUTE_NOT_FOUND,
+    ROUTE_BAD_METHOD,       // path matches, method does not, 405
+};
+
+// result of a lookup, points into routes and request, never allocates
+struct RouteMatch {
+    static constexpr int max_params = 8;
+
+    const Route *route;
+    unsigned allow;         // methods of matched path as 1 << HTTP_METHOD
+    StrView query;          // after '?', empty if none
+    int param_count;
+    const char *names[max_params];
+    StrView params[max_params];
+
+    // value of path parameter, {nullptr, 0} if route has none of that name
+    StrView param(const char *name) const;
+};
+
+/*
+ * radix trie of route patterns, one per process, filled at startup
+ * before any reactor runs and read only after, so lookups take no lock.
+ *
+ * pattern segments are static ("/api/v1/items"), ":name" for one
+ * path segment, or "*name" as last one for the rest of the path
+ * (prefix mount, may be empty). on a lookup static edges win over
+ * ":name", which wins over "*name"; a failed branch, or a path with
+ * no handler for the method, falls back to the next kind. cost is
+ * O(path length) plus that backtracking. HEAD falls back to the GET
+ * handler.
+ */
+class Router {
+public:
+    static Router &instance();
+
+    // false (and a message) if pattern is malformed or method already has a handler there
+    bool registerHandler(HTTP_METHOD method, const char *pattern, RouteHandler handler, bool offload = false,
+                         RouteHandler body = nullptr);
+    // GET pattern answered by html file under root
+    bool registerPage(const char *pattern, const char *file);
+
+    // target is request-target, query string is split off
+    ROUTE_RESULT match(HTTP_METHOD method, const char *target, size_t size, RouteMatch &match) const;
+
+    size_t routeCount() const { return m_routes.size(); }
+    void clear();
+
+private:
+    Router();
+
+    struct Node {
+        std::string label;      // bytes a static edge consumes, or name of ":" / "*" node
+        std::string indices;    // first label byte of each static child
+        std::vector<int> children;
+        int param_child;        // ":name" child, -1 if none
+        int wildcard_child;     // "*name" child, -1 if none
+        unsigned methods;       // methods with a route here
+        int routes[PATCH + 1];  // route index per method, -1 if none
+    };
+
+    int newNode(const char *label, size_t size);
+    int insertStatic(int index, const char *path, size_t size);
+    static int routeOf(const Node &node, HTTP_METHOD method);
+    bool find(int index, const char *path, const char *end, HTTP_METHOD method,
+              RouteMatch &match, int &node, int &other) const;
+
+private:
+    std::vector<Node> m_nodes;      // m_nodes[0] is root
+    std::vector<Route> m_routes;
+};
+
+// routes of the demo site, called once at startup, upload routes only if uploads
+extern void registerDefaultRoutes(Router &router, bool uploads);
+
+#endif //TINYSERVER_ROUTER_H
@@ -0,0 +1,84 @@
+#ifndef TINYSERVER_SPSC_RING_H
+#define TINYSERVER_SPSC_RING_H
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+
+/*
+ * bounded single producer single consumer ring.
+ * slots are filled and read in place (claim/commit, front/pop),
+ * each side caches the other's index so a push or pop only
+ * touches shared cache lines when the cached view runs out.
+ * capacity is rounded up to power of 2.
+ */
+template<typename T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity);
+    ~SpscRing() = default;
+
+    SpscRing(const SpscRing &) = delete;
+    SpscRing &operator=(const SpscRing &) = delete;
+
+    // producer side, nullptr if full
+    T *claim();
+    void commit();
+
+    // consumer side, nullptr if empty
+    T *front();
+    void pop();
+
+private:
+    static constexpr size_t cache_line_size = 64;
+
+    std::unique_ptr<T[]> m_buffer;
+    size_t m_mask;
+    alignas(cache_line_size) std::atomic<size_t> m_tail;    // written by producer
+    size_t m_cached_head;
+    alignas(cache_line_size) std::atomic<size_t> m_head;    // written by consumer
+    size_t m_cached_tail;
+};
+
+template<typename T>
+SpscRing<T>::SpscRing(size_t capacity) : m_tail(0), m_cached_head(0), m_head(0), m_cached_tail(0) {
+    size_t size = 2;
+    while (size < capacity)
+        size <<= 1;
+    m_buffer.reset(new T[size]);
+    m_mask = size - 1;
+}
+
+template<typename T>
+T *SpscRing<T>::claim() {
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail - m_cached_head > m_mask) {
+        m_cached_head = m_head.load(std::memory_order_acquire);
+        if (tail - m_cached_head > m_mask)
+            return nullptr;
+    }
+    return &m_buffer[tail & m_mask];
+}
+
+template<typename T>
+void SpscRing<T>::commit() {
+    m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+template<typename T>
+T *SpscRing<T>::front() {
+    size_t head = m_head.load(std::memory_order_relaxed);
+    if (head == m_cached_tail) {
+        m_cached_tail = m_tail.load(std::memory_order_acquire);
+        if (head == m_cached_tail)
+            return nullptr;
+    }
+    return &m_buffer[head & m_mask];
+}
+
+template<typename T>
+void SpscRing<T>::pop() {
+    m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+#endif //TINYSERVER_SPSC_RING_H
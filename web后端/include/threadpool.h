@@ -1,31 +1,74 @@
 #ifndef TINYSERVER_THREADPOOL_H
 #define TINYSERVER_THREADPOOL_H
 
-#include <queue>
-#include <mutex>
-#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "mpmc_queue.h"
 
 class Runner;
 
+/*
+ * work stealing thread pool.
+ * every worker owns a bounded lock free queue, appendTask() spreads
+ * tasks round robin, an idle worker steals from other queues,
+ * spins for a while and then parks on its semaphore.
+ */
 class ThreadPool {
 public:
     ThreadPool(int thread_num = 16, int max_wait_task = 23333);
     ~ThreadPool();
 
     bool appendTask(Runner *runner);
+    void stop();    // run tasks still queued, then join workers
 
 private:
+    struct Task {
+        Runner *runner;
+        uint64_t enqueue_ns;    // for queue wait metric
+    };
+
+    struct Worker {
+        explicit Worker(size_t capacity);
+        ~Worker();
+
+        MpmcQueue<Task> queue;
+        std::atomic<bool> parked;
+        sem_t sem;
+        pthread_t thread;
+        ThreadPool *pool;
+        int id;
+    };
+
+    // Worker is cache line aligned, before C++17 new does not honour that
+    struct WorkerDeleter {
+        void operator()(Worker *worker) const;
+    };
+    static Worker *newWorker(size_t capacity);
+
     static void *worker(void *arg);
-    void run();
+    void run(Worker &self);
+    bool popTask(Worker &self, Task &task);
+    bool hasTask() const;
+    void wakeUp(int hint);
 
 private:
+    static constexpr int max_spin_count = 256;
+
     int m_thread_num;
+    int m_spin_count;       // no spin on single core, it only delays the producer
     int m_max_wait_task;
 
-    std::queue<Runner *> m_task_queue;
-    std::mutex m_queue_mutex;
-    std::condition_variable m_cv;
-    bool m_stop;
+    std::vector<std::unique_ptr<Worker, WorkerDeleter>> m_workers;
+    std::atomic<unsigned> m_next_worker;
+    std::atomic<int> m_parked_num;
+    std::atomic<int> m_searching_num;   // workers spinning for task
+    std::atomic<bool> m_stop;
 };
 
 #endif //TINYSERVER_THREADPOOL_H
@@ -0,0 +1,46 @@
+#ifndef TINYSERVER_TIMER_WHEEL_H
+#define TINYSERVER_TIMER_WHEEL_H
+
+#include <vector>
+
+class TimerWheel;
+
+// intrusive timer entry, derived class decides what to do on timeout
+class TimerNode {
+public:
+    TimerNode() = default;
+    virtual ~TimerNode() = default;
+
+    virtual void onTimeout() = 0;
+
+private:
+    friend class TimerWheel;
+    TimerNode *m_prev = nullptr;
+    TimerNode *m_next = nullptr;
+    int m_slot = -1;        // -1 means not in wheel
+    int m_rotation = 0;     // full turns left before expire
+};
+
+/*
+ * hashed timing wheel.
+ * every slot keeps a double linked list of timer node,
+ * so add, remove and refresh are all O(1).
+ * tick() advances one slot and expires its due nodes.
+ * not thread safe, must be used by one thread only.
+ */
+class TimerWheel {
+public:
+    explicit TimerWheel(int slot_num = 64);
+    ~TimerWheel() = default;
+
+    void add(TimerNode *node, int ticks);
+    void remove(TimerNode *node);
+    void refresh(TimerNode *node, int ticks);
+    void tick();
+
+private:
+    std::vector<TimerNode *> m_slots;
+    int m_cur_slot;
+};
+
+#endif //TINYSERVER_TIMER_WHEEL_H
@@ -0,0 +1,91 @@
+#ifndef TINYSERVER_URING_H
+#define TINYSERVER_URING_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <linux/io_uring.h>
+
+/*
+ * minimal io_uring ring on raw syscalls, no liburing.
+ * owned and used by one thread only.
+ */
+class Uring {
+public:
+    // throw std::runtime_error if kernel has no io_uring
+    explicit Uring(unsigned entries);
+    ~Uring();
+    Uring(const Uring &) = delete;
+    Uring &operator=(const Uring &) = delete;
+
+    // zeroed sqe, submits queued ones first if ring is full
+    struct io_uring_sqe *getSqe();
+    // submit queued sqes and wait for at least wait_num cqes
+    int submitAndWait(unsigned wait_num);
+
+    // call f(cqe) for every ready cqe, return count
+    template<typename F>
+    unsigned forEachCqe(F f);
+
+    // sparse fixed file table, slots filled by IORING_OP_FILES_UPDATE
+    bool registerSparseFiles(unsigned num);
+
+    // ring of provided buffers for IOSQE_BUFFER_SELECT recv
+    bool setupBufRing(uint16_t group, unsigned num, unsigned size);
+    char *buffer(uint16_t bid) const { return m_bufs + static_cast<size_t>(bid) * m_buf_size; }
+    unsigned bufferSize() const { return m_buf_size; }
+    void recycleBuffer(uint16_t bid);
+
+    unsigned sqeReady() const { return m_sqe_tail - m_sqe_head; }
+
+private:
+    int m_ring_fd;
+    void *m_ring_ptr;       // sq and cq rings share one mapping
+    size_t m_ring_size;
+
+    // submission queue
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned *m_sq_array;
+    unsigned m_sq_mask;
+    unsigned m_sq_entries;
+    struct io_uring_sqe *m_sqes;
+    size_t m_sqes_size;
+    unsigned m_sqe_head;    // sqes handed to kernel
+    unsigned m_sqe_tail;    // sqes filled
+
+    // completion queue
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned m_cq_mask;
+    struct io_uring_cqe *m_cqes;
+
+    // provided buffers
+    struct io_uring_buf_ring *m_buf_ring;
+    size_t m_buf_ring_size;
+    unsigned m_buf_mask;
+    uint16_t m_buf_tail;
+    uint16_t m_buf_group;
+    char *m_bufs;
+    unsigned m_buf_num;
+    unsigned m_buf_size;
+};
+
+template<typename F>
+unsigned Uring::forEachCqe(F f) {
+    unsigned head = *m_cq_head;
+    unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+    unsigned count = 0;
+    while (head != tail) {
+        f(m_cqes[head & m_cq_mask]);
+        ++head;
+        ++count;
+        // release slots early, handler may queue more work
+        __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+        if (head == tail)
+            tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+    }
+    return count;
+}
+
+#endif //TINYSERVER_URING_H
@@ -0,0 +1,108 @@
+#ifndef TINYSERVER_URING_REACTOR_H
+#define TINYSERVER_URING_REACTOR_H
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include <cstdint>
+
+#include <pthread.h>
+
+#include "config.h"
+#include "conn_table.h"
+#include "http_conn.h"
+#include "reactor.h"
+#include "timer_wheel.h"
+#include "uring.h"
+
+/*
+ * event loop on io_uring, completion based counterpart of Reactor.
+ * conns are served run to completion on the loop thread:
+ * multishot accept, recv from a ring of provided buffers,
+ * parse by HttpConn, writev of queued responses.
+ * conns live in the loop's ConnTable, a conn socket sits in the
+ * fixed file table at the conn's slot index and its ops carry conn id.
+ * a conn with ops in flight is shut down first and
+ * only closed when its last completion arrived.
+ */
+class UringReactor : public EventLoop, public ConnLoop {
+public:
+    UringReactor(int id, const ServerConfig &config);
+    ~UringReactor() override;
+
+    static bool supported();    // kernel has every feature used here
+
+    void start() override;
+    void join() override;
+    void notify(uint64_t ev) override;
+
+    void waitRead(HttpConn *conn) override;
+    void waitWrite(HttpConn *conn) override;
+    void dropConn(HttpConn *conn) override;
+    void dispatch(HttpConn *conn) override;
+    void wakeStream(uint64_t conn_id) override;
+
+private:
+    // completion kinds, high 8 bits of user_data, conn id in low 56 bits
+    enum URING_OP {
+        OP_NONE = 0, OP_ACCEPT, OP_NOTIFY, OP_RECV, OP_WRITE, OP_POLL_OUT, OP_FILES_UPDATE,
+        OP_CANCEL,
+    };
+
+    // loop side state of one conn slot
+    struct ConnState {
+        int fixed_fd;       // argument of IORING_OP_FILES_UPDATE, read at submit
+        uint16_t pending;   // ops in flight
+        bool open;
+        bool reading;
+        bool writing;
+        bool closing;
+    };
+
+    static void *worker(void *arg);
+    void loop();
+    void handleCqe(const struct io_uring_cqe &cqe);
+    void handleAccept(const struct io_uring_cqe &cqe);
+    void handleNotify();
+    void resumeStreams();   // write conns woken by wakeStream()
+    void handleRecv(uint64_t id, const struct io_uring_cqe &cqe);
+    void handleWrite(uint64_t id, int res);
+
+    void submitAccept();
+    void cancelAccept();
+    void submitNotify();
+    void submitRecv(uint64_t id);
+    void continueWrite(uint64_t id);
+    void submitPollOut(uint64_t id);
+    struct io_uring_sqe *getSqe(URING_OP op, uint64_t id);
+
+    void closeUser(uint64_t id);
+    void releaseUser(uint64_t id);
+
+private:
+    int m_id;
+    const ServerConfig &m_config;
+    ConnTable m_conns;
+
+    int m_listen_fd;
+    int m_event_fd;     // wake up fd for notify()
+    uint64_t m_event_value;
+    pthread_t m_thread;
+    int m_accept_count;     // conns accepted in this completion batch
+    bool m_accept_armed;    // multishot accept in flight
+    bool m_accept_cancel;   // accept budget used up, cancel sent
+    std::unique_ptr<Uring> m_ring;      // created by loop thread, single issuer
+    std::deque<ConnState> m_states;     // indexed by slot, stable for FILES_UPDATE
+    unsigned m_files;                   // fixed file table size
+
+    TimerWheel m_timer_wheel;
+    int m_idle_ticks;
+    std::atomic<uint64_t> m_pending_ev;
+    std::vector<uint64_t> m_wakeups;    // conn ids from wakeStream()
+    pthread_mutex_t m_wakeup_mutex;
+    bool m_stop;
+};
+
+#endif //TINYSERVER_URING_REACTOR_H
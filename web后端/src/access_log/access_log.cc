@@ -0,0 +1,238 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <new>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "access_log.h"
+#include "http_parser.h"
+#include "metrics.h"
+
+static_assert(sizeof(AccessRecord) == 256, "AccessRecord should fill 4 cache lines");
+
+static const char *method_names[] = {
+        "GET", "POST", "HEAD", "PUT", "DELETE", "CONNECT", "OPTIONS", "TRACE", "PATCH"
+};
+
+static const size_t batch_limit = 256 * 1024;   // write early if one drain formats more
+
+AccessLog &AccessLog::instance() {
+    static AccessLog access_log;
+    return access_log;
+}
+
+AccessLog::AccessLog() : m_enabled(false), m_stop(false), m_thread(0), m_reported_dropped(0),
+                         m_fd(-1), m_file_size(0), m_rotate_size(0), m_keep_files(0),
+                         m_time_sec(-1), m_time_str() {}
+
+AccessLog::~AccessLog() {
+    stop();
+    for (Ring *ring : m_rings) {
+        ring->~Ring();
+        free(ring);
+    }
+}
+
+void AccessLog::open(const std::string &path, size_t rotate_size, int keep_files) {
+    m_path = path;
+    m_rotate_size = rotate_size;
+    m_keep_files = keep_files;
+    m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (m_fd == -1) {
+        printf("%s\n", strerror(errno));
+        throw std::runtime_error("cannot open access log");
+    }
+    m_file_size = static_cast<size_t>(lseek(m_fd, 0, SEEK_END));
+    m_batch.reserve(batch_limit + 1024);
+
+    int err = pthread_create(&m_thread, nullptr, flusher, this);
+    if (err != 0) {
+        close(m_fd);
+        m_fd = -1;
+        throw std::runtime_error("In class AccessLog: create thread error");
+    }
+    m_enabled = true;
+}
+
+void AccessLog::stop() {
+    if (m_thread == 0)
+        return;
+    m_enabled = false;
+    m_stop = true;
+    pthread_join(m_thread, nullptr);
+    m_thread = 0;
+    close(m_fd);
+    m_fd = -1;
+}
+
+AccessLog::Ring *AccessLog::localRing() {
+    static thread_local Ring *ring = nullptr;
+    if (ring == nullptr) {
+        // ring is cache line aligned, before C++17 new does not honour that
+        void *memory = nullptr;
+        if (posix_memalign(&memory, alignof(Ring), sizeof(Ring)) != 0)
+            throw std::bad_alloc();
+        ring = new(memory) Ring();
+        std::lock_guard<std::mutex> g(m_rings_mutex);
+        m_rings.push_back(ring);
+    }
+    return ring;
+}
+
+AccessRecord *AccessLog::claim() {
+    if (!enabled())
+        return nullptr;
+    Ring *ring = localRing();
+    AccessRecord *record = ring->records.claim();
+    if (record == nullptr) {
+        // flusher is behind, never block a conn thread on it
+        ring->dropped.store(ring->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        Metrics::add(CNT_LOG_DROP);
+    }
+    return record;
+}
+
+void AccessLog::commit() {
+    localRing()->records.commit();
+}
+
+void *AccessLog::flusher(void *arg) {
+    auto access_log = static_cast<AccessLog *>(arg);
+    access_log->flushLoop();
+    return access_log;
+}
+
+void AccessLog::flushLoop() {
+    while (!m_stop.load()) {
+        if (drain() == 0)
+            usleep(flush_interval_ms * 1000);
+    }
+    // records committed before stop
+    drain();
+}
+
+/*
+ * format every committed record, written in batches of batch_limit.
+ * return records drained.
+ */
+size_t AccessLog::drain() {
+    std::vector<Ring *> rings;
+    {
+        std::lock_guard<std::mutex> g(m_rings_mutex);
+        rings = m_rings;
+    }
+
+    size_t count = 0;
+    uint64_t dropped = 0;
+    for (Ring *ring : rings) {
+        AccessRecord *record;
+        while ((record = ring->records.front()) != nullptr) {
+            formatRecord(*record);
+            ring->records.pop();
+            ++count;
+            if (m_batch.size() >= batch_limit)
+                writeBatch();
+        }
+        dropped += ring->dropped.load(std::memory_order_relaxed);
+    }
+    if (dropped != m_reported_dropped) {
+        char line[64];
+        int size = snprintf(line, sizeof(line), "# dropped %llu records\n",
+                            static_cast<unsigned long long>(dropped - m_reported_dropped));
+        m_batch.append(line, size);
+        m_reported_dropped = dropped;
+    }
+    writeBatch();
+    return count;
+}
+
+void AccessLog::writeBatch() {
+    size_t written = 0;
+    while (written < m_batch.size()) {
+        ssize_t bytes = write(m_fd, m_batch.data() + written, m_batch.size() - written);
+        if (bytes == -1) {
+            if (errno == EINTR)
+                continue;
+            // disk full or similar, lose this batch rather than stall
+            break;
+        }
+        written += bytes;
+    }
+    m_file_size += written;
+    m_batch.clear();
+    if (m_rotate_size != 0 && m_file_size >= m_rotate_size)
+        rotate();
+}
+
+/*
+ * path.(N-1) -> path.N, ..., path -> path.1, then reopen path
+ */
+void AccessLog::rotate() {
+    for (int i = m_keep_files - 1; i >= 1; --i) {
+        std::string from = m_path + "." + std::to_string(i);
+        std::string to = m_path + "." + std::to_string(i + 1);
+        rename(from.c_str(), to.c_str());
+    }
+    if (m_keep_files > 0)
+        rename(m_path.c_str(), (m_path + ".1").c_str());
+    else
+        unlink(m_path.c_str());
+
+    int fd = ::open(m_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        // keep writing to renamed file
+        return;
+    }
+    close(m_fd);
+    m_fd = fd;
+    m_file_size = 0;
+}
+
+/*
+ * common log format plus latency:
+ * ip - - [time] "METHOD path HTTP/1.x" status bytes latency_us
+ */
+void AccessLog::formatRecord(const AccessRecord &record) {
+    int64_t sec = record.time_ns / 1000000000;
+    if (sec != m_time_sec) {
+        time_t t = static_cast<time_t>(sec);
+        struct tm tm;
+        localtime_r(&t, &tm);
+        strftime(m_time_str, sizeof(m_time_str), "%d/%b/%Y:%H:%M:%S %z", &tm);
+        m_time_sec = sec;
+    }
+
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &record.remote_ip, ip, sizeof(ip));
+
+    char line[128];
+    int size = snprintf(line, sizeof(line), "%s - - [%s] \"", ip, m_time_str);
+    m_batch.append(line, size);
+    if (record.method == AccessRecord::no_method) {
+        m_batch += '-';
+    } else {
+        m_batch += method_names[record.method];
+        m_batch += ' ';
+        // escape quote, backslash and control bytes of target
+        for (uint16_t i = 0; i < record.path_size; ++i) {
+            unsigned char c = static_cast<unsigned char>(record.path[i]);
+            if (c < 0x20 || c >= 0x7f || c == '"' || c == '\\') {
+                char escaped[5];
+                snprintf(escaped, sizeof(escaped), "\\x%02x", c);
+                m_batch.append(escaped, 4);
+            } else {
+                m_batch += static_cast<char>(c);
+            }
+        }
+        m_batch += record.version == HTTP_1_1 ? " HTTP/1.1" : " HTTP/1.0";
+    }
+    size = snprintf(line, sizeof(line), "\" %u %llu %u\n", record.status,
+                    static_cast<unsigned long long>(record.bytes), record.latency_us);
+    m_batch.append(line, size);
+}
@@ -0,0 +1,119 @@
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "buffer_pool.h"
+
+static const size_t class_sizes[BufferPool::class_num] = {4096, 16384, 65536};
+static const size_t thread_cache_limit = 64;    // per class
+static const size_t global_cache_limit = 1024;  // per class
+
+// shared free lists, filled when a thread cache overflows
+static std::mutex global_mutex;
+static std::vector<char *> global_cache[BufferPool::class_num];
+
+// per thread free lists, returned to shared lists on thread exit
+struct ThreadCache {
+    ~ThreadCache() {
+        std::lock_guard<std::mutex> g(global_mutex);
+        for (int i = 0; i < BufferPool::class_num; ++i) {
+            for (char *buf : lists[i]) {
+                if (global_cache[i].size() < global_cache_limit)
+                    global_cache[i].push_back(buf);
+                else
+                    free(buf);
+            }
+        }
+    }
+    std::vector<char *> lists[BufferPool::class_num];
+};
+
+static thread_local ThreadCache thread_cache;
+
+static int classOf(size_t size) {
+    for (int i = 0; i < BufferPool::class_num; ++i) {
+        if (size <= class_sizes[i])
+            return i;
+    }
+    return -1;
+}
+
+char *BufferPool::acquire(size_t size, size_t &capacity) {
+    int class_ind = classOf(size);
+    if (class_ind == -1)
+        return nullptr;
+    capacity = class_sizes[class_ind];
+
+    std::vector<char *> &local = thread_cache.lists[class_ind];
+    if (local.empty()) {
+        // refill half of local cache at once
+        std::lock_guard<std::mutex> g(global_mutex);
+        std::vector<char *> &global = global_cache[class_ind];
+        while (!global.empty() && local.size() < thread_cache_limit / 2) {
+            local.push_back(global.back());
+            global.pop_back();
+        }
+    }
+    if (!local.empty()) {
+        char *buf = local.back();
+        local.pop_back();
+        return buf;
+    }
+    return static_cast<char *>(malloc(capacity));
+}
+
+void BufferPool::release(char *buf, size_t capacity) {
+    int class_ind = classOf(capacity);
+    if (buf == nullptr || class_ind == -1)
+        return;
+
+    std::vector<char *> &local = thread_cache.lists[class_ind];
+    if (local.size() < thread_cache_limit) {
+        local.push_back(buf);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> g(global_mutex);
+        if (global_cache[class_ind].size() < global_cache_limit) {
+            global_cache[class_ind].push_back(buf);
+            return;
+        }
+    }
+    free(buf);
+}
+
+size_t BufferPool::maxSize() {
+    return class_sizes[class_num - 1];
+}
+
+size_t BufferPool::classSize(int class_ind) {
+    return class_sizes[class_ind];
+}
+
+Buffer::~Buffer() {
+    release();
+}
+
+bool Buffer::reserve(size_t size) {
+    if (size <= m_capacity)
+        return true;
+    size_t capacity;
+    char *data = BufferPool::acquire(size, capacity);
+    if (data == nullptr)
+        return false;
+    if (m_data != nullptr) {
+        memcpy(data, m_data, m_capacity);
+        BufferPool::release(m_data, m_capacity);
+    }
+    m_data = data;
+    m_capacity = capacity;
+    return true;
+}
+
+void Buffer::release() {
+    if (m_data != nullptr)
+        BufferPool::release(m_data, m_capacity);
+    m_data = nullptr;
+    m_capacity = 0;
+}
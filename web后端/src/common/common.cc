@@ -1,8 +1,18 @@
+#include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <sched.h>
+#include <pthread.h>
 #include <assert.h>
+#include <unistd.h>
+#include <stdexcept>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/epoll.h>
+#include <sys/socket.h>
 
 #include "common.h"
 
@@ -13,26 +23,24 @@ int setNonBlocking(int fd) {
     return old_option;
 }
 
-int addToEpoll(int epoll_fd, int fd, bool oneshot) {
+int addToEpoll(int epoll_fd, int fd, uint64_t data, bool oneshot) {
     struct epoll_event event;
     memset(&event, 0, sizeof(event));
-    event.data.fd = fd;
+    event.data.u64 = data;
     event.events = EPOLLIN | EPOLLERR | EPOLLRDHUP | EPOLLET;
     if (oneshot)
         event.events |= EPOLLONESHOT;
-    int ret = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
-    setNonBlocking(fd);
-    return ret;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
 }
 
 int removeFromEpoll(int epoll_fd, int fd) {
     return epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
 }
 
-int modFd(int epoll_fd, int fd, int ev) {
+int modFd(int epoll_fd, int fd, uint64_t data, int ev) {
     struct epoll_event event;
     memset(&event, 0, sizeof(event));
-    event.data.fd = fd;
+    event.data.u64 = data;
     event.events = ev | EPOLLET | EPOLLERR | EPOLLRDHUP;
     return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
 }
@@ -73,3 +81,58 @@ char *int2C_string(int num, char *str) {
 
     return str;
 }
+
+/*
+ * nonblocking listen fd bound to port, SO_REUSEPORT lets every
+ * reactor own one on the same port. TCP_DEFER_ACCEPT wakes accept only
+ * when request bytes arrived, TCP_NODELAY is inherited by accepted conns.
+ */
+int createListenFd(int port, int backlog, int defer_accept, bool nodelay) {
+    int listen_fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd == -1) {
+        printf("%s\n", strerror(errno));
+        throw std::runtime_error("cannot create listen fd");
+    }
+
+    int status = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &status, sizeof(status));
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &status, sizeof(status));
+    if (defer_accept > 0)
+        setsockopt(listen_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer_accept, sizeof(defer_accept));
+    if (nodelay)
+        setsockopt(listen_fd, IPPROTO_TCP, TCP_NODELAY, &status, sizeof(status));
+
+    struct sockaddr_in listen_address;
+    memset(&listen_address, 0, sizeof(listen_address));
+    listen_address.sin_family = AF_INET;
+    listen_address.sin_addr.s_addr = htonl(INADDR_ANY);
+    listen_address.sin_port = htons(port);
+
+    int err = bind(listen_fd, reinterpret_cast<struct sockaddr *>(&listen_address), sizeof(listen_address));
+    if (err == -1) {
+        printf("%s\n", strerror(errno));
+        close(listen_fd);
+        throw std::runtime_error("bind socket error");
+    }
+
+    err = listen(listen_fd, backlog);
+    if (err == -1) {
+        printf("%s\n", strerror(errno));
+        close(listen_fd);
+        throw std::runtime_error("listen socket error");
+    }
+    return listen_fd;
+}
+
+/*
+ * keep an event loop thread and its conns on one core
+ */
+void pinThread(pthread_t thread, int id) {
+    long cpu_num = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpu_num > 1) {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(id % cpu_num, &cpu_set);
+        pthread_setaffinity_np(thread, sizeof(cpu_set), &cpu_set);
+    }
+}
@@ -0,0 +1,105 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include <unistd.h>
+
+#include "config.h"
+
+void printUsage(const char *prog) {
+    printf("usage: %s [-t idle_timeout] [-m max_requests] [-a tick_interval] [-n reactor_num] [-s sendfile_threshold] [-C cache_bytes] [-l access_log] [-r log_rotate_size] [-e epoll|uring] [-c prefix=cache_control ...] [-b backlog] [-d defer_accept] [-N] [-A accept_budget] [-i inline_limit] [-B max_body] [-u] port\n", prog);
+}
+
+/*
+ * parse command line options into config.
+ * throw std::runtime_error if any option is invalid.
+ */
+void parseConfig(int argc, char **argv, ServerConfig &config) {
+    int opt;
+    while ((opt = getopt(argc, argv, "t:m:a:n:s:C:l:r:e:c:b:d:NA:i:B:u")) != -1) {
+        switch (opt) {
+            case 't':
+                config.idle_timeout = atoi(optarg);
+                break;
+            case 'm':
+                config.max_requests = atoi(optarg);
+                break;
+            case 'a':
+                config.tick_interval = atoi(optarg);
+                break;
+            case 'n':
+                config.reactor_num = atoi(optarg);
+                break;
+            case 's':
+                config.sendfile_threshold = atol(optarg);
+                break;
+            case 'C':
+                config.cache_bytes = atoll(optarg);
+                break;
+            case 'l':
+                config.access_log = optarg;
+                break;
+            case 'r':
+                config.log_rotate_size = atol(optarg);
+                break;
+            case 'e':
+                if (strcmp(optarg, "uring") == 0) {
+                    config.io_uring = true;
+                } else if (strcmp(optarg, "epoll") == 0) {
+                    config.io_uring = false;
+                } else {
+                    printUsage(argv[0]);
+                    throw std::runtime_error("invalid main args");
+                }
+                break;
+            case 'c': {
+                // "/funny_mystery_box/=max-age=86400", split at first '='
+                const char *eq = strchr(optarg, '=');
+                if (eq == nullptr || eq == optarg || optarg[0] != '/' || *(eq + 1) == '\0') {
+                    printUsage(argv[0]);
+                    throw std::runtime_error("invalid main args");
+                }
+                config.cache_control.emplace_back(std::string(optarg, eq - optarg), std::string(eq + 1));
+                break;
+            }
+            case 'b':
+                config.backlog = atoi(optarg);
+                break;
+            case 'd':
+                config.defer_accept = atoi(optarg);
+                break;
+            case 'N':
+                config.nodelay = true;
+                break;
+            case 'A':
+                config.accept_budget = atoi(optarg);
+                break;
+            case 'i':
+                config.inline_limit = atol(optarg);
+                break;
+            case 'B':
+                config.max_body = atoll(optarg);
+                break;
+            case 'u':
+                config.uploads = true;
+                break;
+            default:
+                printUsage(argv[0]);
+                throw std::runtime_error("invalid main args");
+        }
+    }
+    if (optind != argc - 1) {
+        printUsage(argv[0]);
+        throw std::runtime_error("invalid main args");
+    }
+    config.port = atoi(argv[optind]);
+
+    if (config.port <= 0 || config.idle_timeout <= 0 ||
+        config.max_requests <= 0 || config.tick_interval <= 0 ||
+        config.reactor_num <= 0 || config.sendfile_threshold < 0 || config.cache_bytes < 0 ||
+        config.log_rotate_size < 0 || config.backlog <= 0 ||
+        config.defer_accept < 0 || config.accept_budget <= 0 ||
+        config.inline_limit < 0 || config.max_body < 0)
+        throw std::runtime_error("invalid main args");
+}
@@ -0,0 +1,53 @@
+#include "conn_table.h"
+
+ConnTable::ConnTable() : m_free_head(no_slot), m_active(0) {}
+
+/*
+ * one more slab, its slots go to free list in index order
+ */
+void ConnTable::grow() {
+    auto first = static_cast<uint32_t>(m_slots.size());
+    m_slabs.emplace_back(new HttpConn[slab_size]);
+    HttpConn *slab = m_slabs.back().get();
+    m_slots.resize(first + slab_size);
+    for (uint32_t i = 0; i < slab_size; ++i) {
+        Slot &slot = m_slots[first + i];
+        slot.generation = 0;
+        slot.next_free = i + 1 < slab_size ? first + i + 1 : m_free_head;
+        slot.conn = slab + i;
+        slot.used = false;
+    }
+    m_free_head = first;
+}
+
+HttpConn *ConnTable::acquire(uint64_t &id) {
+    if (m_free_head == no_slot)
+        grow();
+    uint32_t index = m_free_head;
+    Slot &slot = m_slots[index];
+    m_free_head = slot.next_free;
+    slot.used = true;
+    ++m_active;
+    id = static_cast<uint64_t>(slot.generation) << 32 | index;
+    return slot.conn;
+}
+
+void ConnTable::release(uint64_t id) {
+    uint32_t index = ConnTable::index(id);
+    Slot &slot = m_slots[index];
+    slot.generation = (slot.generation + 1) & generation_mask;
+    slot.used = false;
+    slot.next_free = m_free_head;
+    m_free_head = index;
+    --m_active;
+}
+
+HttpConn *ConnTable::find(uint64_t id) const {
+    uint32_t index = ConnTable::index(id);
+    if (index >= m_slots.size())
+        return nullptr;
+    const Slot &slot = m_slots[index];
+    if (!slot.used || slot.generation != (id & id_mask) >> 32)
+        return nullptr;
+    return slot.conn;
+}
@@ -0,0 +1,676 @@
+#include <string>
+#include <tuple>
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#if defined(SYS_openat2) && __has_include(<linux/openat2.h>)
+#include <linux/openat2.h>
+#define TINYSERVER_OPENAT2
+#endif
+
+#ifdef TINYSERVER_ZLIB
+#include <zlib.h>
+#endif
+#ifdef TINYSERVER_BROTLI
+#include <brotli/encode.h>
+#endif
+
+#include "file_cache.h"
+#include "mime_types.h"
+
+static const char *encoding_suffix[] = {"", ".gz", ".br"};
+static const char *encoding_name[] = {"identity", "gzip", "br"};
+static const char *etag_suffix[] = {"", "-gz", "-br"};    // variants differ in bytes, so in tag
+static const off_t min_compress_size = 256;     // below it headers outweigh savings
+static const time_t missing_ttl = 2;            // seconds a failed lookup is remembered
+static const size_t max_missing = 4096;         // random 404s can not grow it beyond
+static const size_t max_files = 1024;           // cached files, bounds fds of sendfile() ones too
+// compressed by the request that misses, so speed matters more than last few percent
+static const int gzip_level = 6;
+static const int brotli_quality = 5;
+// a file is dropped once written, not on every write(2) to it
+static const uint32_t watch_mask = IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE |
+                                   IN_MOVED_FROM | IN_MOVED_TO | IN_CREATE;
+
+#ifdef TINYSERVER_ZLIB
+static bool gzipCompress(const char *data, size_t size, std::string &out) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // 15 + 16: zlib window with gzip wrapper
+    if (deflateInit2(&stream, gzip_level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+    out.resize(deflateBound(&stream, size));
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    stream.avail_in = static_cast<uInt>(size);
+    stream.next_out = reinterpret_cast<Bytef *>(&out[0]);
+    stream.avail_out = static_cast<uInt>(out.size());
+    int ret = deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    return ret == Z_STREAM_END;
+}
+#endif
+
+#ifdef TINYSERVER_BROTLI
+static bool brotliCompress(const char *data, size_t size, std::string &out) {
+    size_t out_size = BrotliEncoderMaxCompressedSize(size);
+    if (out_size == 0)
+        return false;
+    out.resize(out_size);
+    if (!BrotliEncoderCompress(brotli_quality, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, size,
+                               reinterpret_cast<const uint8_t *>(data), &out_size,
+                               reinterpret_cast<uint8_t *>(&out[0])))
+        return false;
+    out.resize(out_size);
+    return true;
+}
+#endif
+
+static bool compress(CONTENT_ENCODING encoding, const char *data, size_t size, std::string &out) {
+    switch (encoding) {
+#ifdef TINYSERVER_ZLIB
+        case ENC_GZIP:
+            return gzipCompress(data, size, out);
+#endif
+#ifdef TINYSERVER_BROTLI
+        case ENC_BR:
+            return brotliCompress(data, size, out);
+#endif
+        default:
+            return false;
+    }
+}
+
+CachedFile::~CachedFile() {
+    if (address != nullptr && compressed.empty())
+        munmap(address, file_stat.st_size);
+    if (fd != -1)
+        close(fd);
+}
+
+const std::string &CachedFile::header(bool keep_alive) const {
+    return keep_alive ? header_keep_alive : header_close;
+}
+
+const std::string &CachedFile::notModifiedHeader(bool keep_alive) const {
+    return keep_alive ? not_modified_keep_alive : not_modified_close;
+}
+
+FileCache &FileCache::instance() {
+    static FileCache cache;
+    return cache;
+}
+
+/*
+ * document root is the working directory, main() changes into it
+ * before first use
+ */
+FileCache::FileCache() : m_bytes(0), m_cache_bytes(64 * 1024 * 1024), m_clock(0), m_openat2(false), m_generation(0),
+                         m_sendfile_threshold(128 * 1024), m_watcher_started(false) {
+    pthread_rwlock_init(&m_lock, nullptr);
+    pthread_mutex_init(&m_load_mutex, nullptr);
+    pthread_cond_init(&m_load_cond, nullptr);
+    pthread_mutex_init(&m_watch_mutex, nullptr);
+    m_inotify_fd = inotify_init1(IN_CLOEXEC);
+    m_root_fd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+#ifdef TINYSERVER_OPENAT2
+    m_openat2 = true;
+    int fd = openBeneath(".");
+    if (fd == -1 && errno == ENOSYS)
+        m_openat2 = false;
+    else if (fd != -1)
+        close(fd);
+#endif
+}
+
+FileCache::~FileCache() {
+    if (m_root_fd != -1)
+        close(m_root_fd);
+    if (m_inotify_fd != -1)
+        close(m_inotify_fd);
+    pthread_mutex_destroy(&m_watch_mutex);
+    pthread_cond_destroy(&m_load_cond);
+    pthread_mutex_destroy(&m_load_mutex);
+    pthread_rwlock_destroy(&m_lock);
+}
+
+bool FileCache::contains(const char *path) {
+    std::string key(path);
+    pthread_rwlock_rdlock(&m_lock);
+    bool found = m_files.find(key) != m_files.end();
+    if (!found) {
+        auto missing = m_missing.find(key);
+        found = missing != m_missing.end() && missing->second.expires > time(nullptr);
+    }
+    pthread_rwlock_unlock(&m_lock);
+    return found;
+}
+
+/*
+ * get file from cache, load it on miss.
+ * return FILE_REQUEST if ok, otherwise the error code to respond,
+ * a recent failure of same path is answered without touching disk.
+ * concurrent misses of a path open and compress it only once.
+ */
+HTTP_CODE FileCache::get(const char *path, unsigned accept_encodings, std::shared_ptr<const CachedFile> &file) {
+    std::string key(path);
+    while (true) {
+        pthread_rwlock_rdlock(&m_lock);
+        auto it = m_files.find(key);
+        if (it != m_files.end()) {
+            file = it->second.file;
+            // stored only if changed, hits of a hot file do not keep writing its cache line
+            unsigned long now = m_clock.load(std::memory_order_relaxed);
+            if (it->second.used.load(std::memory_order_relaxed) != now)
+                it->second.used.store(now, std::memory_order_relaxed);
+            pthread_rwlock_unlock(&m_lock);
+            selectVariant(file, accept_encodings);
+            return FILE_REQUEST;
+        }
+        auto missing = m_missing.find(key);
+        if (missing != m_missing.end() && missing->second.expires > time(nullptr)) {
+            HTTP_CODE code = missing->second.code;
+            pthread_rwlock_unlock(&m_lock);
+            return code;
+        }
+        pthread_rwlock_unlock(&m_lock);
+
+        // one miss of a path loads it, concurrent ones wait and look again
+        pthread_mutex_lock(&m_load_mutex);
+        bool loader = m_loading.insert(key).second;
+        while (!loader && m_loading.count(key) != 0)
+            pthread_cond_wait(&m_load_cond, &m_load_mutex);
+        pthread_mutex_unlock(&m_load_mutex);
+        if (loader)
+            break;
+    }
+
+    unsigned long generation = m_generation.load();
+    HTTP_CODE ret = load(path, file);
+    if (ret == FILE_REQUEST) {
+        selectVariant(file, accept_encodings);
+    } else if (ret == NO_RESOURCE || ret == FORBIDDEN_REQUEST) {
+        pthread_rwlock_wrlock(&m_lock);
+        // a file created meanwhile must not be hidden
+        if (m_generation.load() == generation) {
+            if (m_missing.size() >= max_missing)
+                m_missing.clear();
+            m_missing[key] = Missing{ret, time(nullptr) + missing_ttl};
+        }
+        pthread_rwlock_unlock(&m_lock);
+    }
+
+    pthread_mutex_lock(&m_load_mutex);
+    m_loading.erase(key);
+    pthread_cond_broadcast(&m_load_cond);
+    pthread_mutex_unlock(&m_load_mutex);
+    return ret;
+}
+
+/*
+ * open path below m_root_fd: openat2() refuses "..", absolute paths
+ * and symlinks leading out of root. without it only a symlink could
+ * lead out of a normalized path.
+ */
+int FileCache::openBeneath(const char *path) const {
+#ifdef TINYSERVER_OPENAT2
+    if (m_openat2) {
+        struct open_how how;
+        memset(&how, 0, sizeof(how));
+        how.flags = O_RDONLY | O_CLOEXEC | O_NOCTTY;
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+        return static_cast<int>(syscall(SYS_openat2, m_root_fd, path, &how, sizeof(how)));
+    }
+#endif
+    return openat(m_root_fd, path, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+}
+
+void FileCache::selectVariant(std::shared_ptr<const CachedFile> &file, unsigned accept_encodings) {
+    // smallest coding first, variant shares ownership with identity file
+    for (CONTENT_ENCODING encoding : {ENC_BR, ENC_GZIP}) {
+        const CachedFile *variant = file->variants[encoding].get();
+        if (variant != nullptr && (accept_encodings & (1u << encoding))) {
+            file = std::shared_ptr<const CachedFile>(file, variant);
+            return;
+        }
+    }
+}
+
+/*
+ * stat and open or map one file on disk, no headers
+ */
+HTTP_CODE FileCache::loadBody(const char *path, CachedFile &file) {
+    int fd = openBeneath(path);
+    if (fd == -1)
+        return errno == EXDEV || errno == ELOOP || errno == EACCES ? FORBIDDEN_REQUEST : NO_RESOURCE;
+    fstat(fd, &file.file_stat);
+    HTTP_CODE ret = FILE_REQUEST;
+    if (!S_ISREG(file.file_stat.st_mode))
+        ret = NO_RESOURCE;
+    else if (!(file.file_stat.st_mode & S_IROTH))
+        ret = FORBIDDEN_REQUEST;
+    if (ret != FILE_REQUEST) {
+        close(fd);
+        return ret;
+    }
+
+    if (file.file_stat.st_size >= m_sendfile_threshold) {
+        // large body is streamed from fd by sendfile(), never mapped
+        file.fd = fd;
+    } else {
+        if (file.file_stat.st_size != 0) {
+            void *address = mmap(nullptr, file.file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address == MAP_FAILED)
+                ret = INTERNAL_ERROR;
+            else
+                file.address = reinterpret_cast<char *>(address);
+        }
+        close(fd);
+        if (ret != FILE_REQUEST)
+            return ret;
+    }
+    file.path = path;
+    return FILE_REQUEST;
+}
+
+/*
+ * variant per coding: a precompressed sibling (path.gz, path.br)
+ * not older than file, else file compressed once here if it is text.
+ * a variant not smaller than identity is dropped.
+ */
+void FileCache::loadVariants(const CachedFile &file, bool compressible,
+                             std::unique_ptr<CachedFile> *variants) {
+    for (int i = ENC_IDENTITY + 1; i < ENC_COUNT; ++i) {
+        auto encoding = static_cast<CONTENT_ENCODING>(i);
+        std::unique_ptr<CachedFile> variant(new CachedFile());
+        std::string sibling = file.path + encoding_suffix[encoding];
+        struct stat sibling_stat;
+        if (fstatat(m_root_fd, sibling.c_str(), &sibling_stat, 0) == 0 && sibling_stat.st_mtime >= file.file_stat.st_mtime) {
+            if (loadBody(sibling.c_str(), *variant) != FILE_REQUEST)
+                continue;
+        } else if (compressible && file.address != nullptr &&
+                   file.file_stat.st_size >= min_compress_size) {
+            if (!compress(encoding, file.address, file.file_stat.st_size, variant->compressed))
+                continue;
+            variant->file_stat = file.file_stat;
+            variant->file_stat.st_size = static_cast<off_t>(variant->compressed.size());
+            variant->address = &variant->compressed[0];
+            variant->path = sibling;
+        } else {
+            continue;
+        }
+        if (variant->file_stat.st_size >= file.file_stat.st_size)
+            continue;
+        variant->encoding = encoding;
+        variants[encoding] = std::move(variant);
+    }
+}
+
+HTTP_CODE FileCache::load(const char *path, std::shared_ptr<const CachedFile> &file) {
+    unsigned long generation = m_generation.load();
+
+    std::shared_ptr<CachedFile> loaded = std::make_shared<CachedFile>();
+    HTTP_CODE ret = loadBody(path, *loaded);
+    if (ret != FILE_REQUEST)
+        return ret;
+    // a download gets no type from its extension, so no compressed variants either
+    bool download = attachment(loaded->path);
+    const MimeType &mime = mimeType(download ? "" : path);
+    std::unique_ptr<CachedFile> variants[ENC_COUNT];
+    loadVariants(*loaded, mime.compressible, variants);
+
+    // validators come from identity file, every variant shares them
+    char etag[64];
+    snprintf(etag, sizeof(etag), "%lx-%lx-%lx", static_cast<unsigned long>(loaded->file_stat.st_ino),
+             static_cast<unsigned long>(loaded->file_stat.st_size),
+             static_cast<unsigned long>(loaded->file_stat.st_mtime));
+    char last_modified[32];
+    struct tm tm;
+    gmtime_r(&loaded->file_stat.st_mtime, &tm);
+    strftime(last_modified, sizeof(last_modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    const char *cache_control = cacheControl(loaded->path);
+
+    // every variant says response depends on Accept-Encoding
+    bool vary = false;
+    for (auto &variant : variants)
+        vary = vary || variant != nullptr;
+    for (int i = 0; i < ENC_COUNT; ++i) {
+        CachedFile *target = i == ENC_IDENTITY ? loaded.get() : variants[i].get();
+        if (target == nullptr)
+            continue;
+        target->etag = std::string("\"") + etag + etag_suffix[i] + "\"";
+        target->mtime = loaded->file_stat.st_mtime;
+
+        // shared by 200, 206 and 304
+        std::string validators = "ETag: " + target->etag + "\r\n";
+        validators += "Last-Modified: ";
+        validators += last_modified;
+        validators += "\r\n";
+        if (cache_control != nullptr) {
+            validators += "Cache-Control: ";
+            validators += cache_control;
+            validators += "\r\n";
+        }
+        if (vary)
+            validators += "Vary: Accept-Encoding\r\n";
+
+        // shared by 200 and 206
+        target->content_type = mime.type;
+        if (i != ENC_IDENTITY) {
+            target->entity_headers = "Content-Encoding: ";
+            target->entity_headers += encoding_name[i];
+            target->entity_headers += "\r\n";
+        }
+        target->entity_headers += validators;
+        target->entity_headers += "Accept-Ranges: bytes\r\n";
+        if (download)
+            target->entity_headers += "Content-Disposition: attachment\r\nX-Content-Type-Options: nosniff\r\n";
+
+        std::string header = "HTTP/1.1 200 OK\r\n";
+        header += "Content-Type: ";
+        header += target->content_type;
+        header += "\r\n";
+        header += target->entity_headers;
+        header += "Content-Length: ";
+        header += std::to_string(target->file_stat.st_size);
+        header += "\r\nConnection: ";
+        target->header_keep_alive = header + "keep-alive\r\n\r\n";
+        target->header_close = header + "close\r\n\r\n";
+
+        header = "HTTP/1.1 304 Not Modified\r\n";
+        header += validators;
+        header += "Connection: ";
+        target->not_modified_keep_alive = header + "keep-alive\r\n\r\n";
+        target->not_modified_close = header + "close\r\n\r\n";
+        if (i != ENC_IDENTITY)
+            loaded->variants[i] = std::move(variants[i]);
+    }
+
+    file = loaded;
+
+    // file changed while loading, serve it once but do not cache
+    pthread_rwlock_wrlock(&m_lock);
+    if (m_generation.load() == generation)
+        insert(loaded);
+    pthread_rwlock_unlock(&m_lock);
+    return FILE_REQUEST;
+}
+
+// bytes a cached file keeps in memory, an fd kept for sendfile() has none
+static size_t residentBytes(const CachedFile &file) {
+    size_t bytes = file.address != nullptr ? static_cast<size_t>(file.file_stat.st_size) : 0;
+    for (auto &variant : file.variants) {
+        if (variant != nullptr && variant->address != nullptr)
+            bytes += static_cast<size_t>(variant->file_stat.st_size);
+    }
+    return bytes;
+}
+
+// called with write lock
+void FileCache::insert(const std::shared_ptr<const CachedFile> &file) {
+    drop(file->path);
+    size_t bytes = residentBytes(*file);
+    m_files.emplace(std::piecewise_construct, std::forward_as_tuple(file->path),
+                    std::forward_as_tuple(file, bytes, ++m_clock));
+    m_bytes += bytes;
+    evict();
+}
+
+// called with write lock
+void FileCache::drop(const std::string &path) {
+    auto it = m_files.find(path);
+    if (it == m_files.end())
+        return;
+    m_bytes -= it->second.bytes;
+    m_files.erase(it);
+}
+
+/*
+ * drop least recently used files until both limits hold, called with
+ * write lock. a linear scan, but only when a miss fills the cache,
+ * a hit stays a lookup. a conn sending an evicted file keeps it alive.
+ */
+void FileCache::evict() {
+    while (m_files.size() > max_files || m_bytes > m_cache_bytes) {
+        auto victim = m_files.begin();
+        for (auto it = m_files.begin(); it != m_files.end(); ++it) {
+            if (it->second.used.load(std::memory_order_relaxed) < victim->second.used.load(std::memory_order_relaxed))
+                victim = it;
+        }
+        m_bytes -= victim->second.bytes;
+        m_files.erase(victim);
+    }
+}
+
+void FileCache::setSendfileThreshold(off_t threshold) {
+    m_sendfile_threshold = threshold;
+}
+
+void FileCache::setCacheBytes(size_t bytes) {
+    m_cache_bytes = bytes;
+}
+
+void FileCache::setCacheControl(const std::vector<std::pair<std::string, std::string>> &rules) {
+    m_cache_control = rules;
+}
+
+/*
+ * policy of longest prefix matching "/" + path, nullptr if none
+ */
+const char *FileCache::cacheControl(const std::string &path) const {
+    std::string request_path = "/" + path;
+    const char *policy = nullptr;
+    size_t matched = 0;
+    for (auto &rule : m_cache_control) {
+        if (rule.first.size() >= matched && request_path.compare(0, rule.first.size(), rule.first) == 0) {
+            policy = rule.second.c_str();
+            matched = rule.first.size();
+        }
+    }
+    return policy;
+}
+
+void FileCache::addAttachment(const std::string &prefix) {
+    m_attachments.push_back(prefix);
+}
+
+bool FileCache::attachment(const std::string &path) const {
+    std::string request_path = "/" + path;
+    for (auto &prefix : m_attachments) {
+        if (request_path.compare(0, prefix.size(), prefix) == 0)
+            return true;
+    }
+    return false;
+}
+
+void FileCache::invalidate(const std::string &path) {
+    pthread_rwlock_wrlock(&m_lock);
+    ++m_generation;
+    dropChanged(path);
+    pthread_rwlock_unlock(&m_lock);
+}
+
+/*
+ * path changed on disk, called with write lock.
+ * a changed sibling path.gz or path.br drops path too,
+ * a failed lookup of path may succeed now.
+ */
+void FileCache::dropChanged(const std::string &path) {
+    drop(path);
+    m_missing.erase(path);
+    for (int i = ENC_IDENTITY + 1; i < ENC_COUNT; ++i) {
+        size_t suffix_size = strlen(encoding_suffix[i]);
+        if (path.size() > suffix_size &&
+            path.compare(path.size() - suffix_size, suffix_size, encoding_suffix[i]) == 0)
+            drop(path.substr(0, path.size() - suffix_size));
+    }
+}
+
+// files and failed lookups under prefix, "" for all of them, called with write lock
+void FileCache::dropChangedDir(const std::string &prefix) {
+    for (auto it = m_files.begin(); it != m_files.end();) {
+        if (it->first.compare(0, prefix.size(), prefix) == 0) {
+            m_bytes -= it->second.bytes;
+            it = m_files.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    if (prefix.empty()) {
+        m_missing.clear();
+        return;
+    }
+    for (auto it = m_missing.begin(); it != m_missing.end();) {
+        if (it->first.compare(0, prefix.size(), prefix) == 0)
+            it = m_missing.erase(it);
+        else
+            ++it;
+    }
+}
+
+/*
+ * watch dir and every directory below it, start watcher thread on
+ * first call. dir "." maps to file names without prefix.
+ */
+void FileCache::watch(const char *dir) {
+    if (m_inotify_fd == -1)
+        return;
+    watchTree(strcmp(dir, ".") == 0 ? std::string() : std::string(dir));
+
+    pthread_mutex_lock(&m_watch_mutex);
+    bool start = !m_watcher_started;
+    m_watcher_started = true;
+    pthread_mutex_unlock(&m_watch_mutex);
+
+    if (start) {
+        pthread_t thread;
+        if (pthread_create(&thread, nullptr, watcher, this) == 0)
+            pthread_detach(thread);
+    }
+}
+
+// dir relative to root, "" is root. symlinked directories are not followed
+void FileCache::watchTree(const std::string &dir) {
+    const char *path = dir.empty() ? "." : dir.c_str();
+    int wd = inotify_add_watch(m_inotify_fd, path, watch_mask | IN_ONLYDIR | IN_DONT_FOLLOW);
+    if (wd == -1)
+        return;
+    std::string prefix = dir.empty() ? std::string() : dir + "/";
+    pthread_mutex_lock(&m_watch_mutex);
+    m_watch_dirs[wd] = prefix;
+    pthread_mutex_unlock(&m_watch_mutex);
+
+    DIR *handle = opendir(path);
+    if (handle == nullptr)
+        return;
+    while (struct dirent *entry = readdir(handle)) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        struct stat entry_stat;
+        if (entry->d_type == DT_DIR ||
+            (entry->d_type == DT_UNKNOWN && fstatat(dirfd(handle), entry->d_name, &entry_stat, AT_SYMLINK_NOFOLLOW) == 0 &&
+             S_ISDIR(entry_stat.st_mode)))
+            watchTree(prefix + entry->d_name);
+    }
+    closedir(handle);
+}
+
+void FileCache::onChange(const std::string &prefix, std::function<void()> callback) {
+    pthread_mutex_lock(&m_watch_mutex);
+    m_listeners.emplace_back(prefix, std::move(callback));
+    pthread_mutex_unlock(&m_watch_mutex);
+}
+
+void *FileCache::watcher(void *arg) {
+    auto cache = static_cast<FileCache *>(arg);
+    cache->watchLoop();
+    return cache;
+}
+
+void FileCache::watchLoop() {
+    alignas(struct inotify_event) char buf[4096];
+    while (true) {
+        ssize_t bytes = read(m_inotify_fd, buf, sizeof(buf));
+        if (bytes <= 0) {
+            if (bytes == -1 && errno == EINTR)
+                continue;
+            return;
+        }
+        // a batch of events is applied under one write lock, then listeners run once
+        std::vector<std::string> paths;
+        std::vector<std::string> dirs;
+        bool overflow = false;
+        std::vector<std::function<void()>> callbacks;
+        std::vector<bool> triggered;
+        for (char *p = buf; p < buf + bytes;) {
+            auto event = reinterpret_cast<struct inotify_event *>(p);
+            p += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                // events were lost, any file may have changed
+                overflow = true;
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                // directory removed, or its watch by a move below
+                pthread_mutex_lock(&m_watch_mutex);
+                m_watch_dirs.erase(event->wd);
+                pthread_mutex_unlock(&m_watch_mutex);
+                continue;
+            }
+            if (event->len == 0)
+                continue;
+
+            pthread_mutex_lock(&m_watch_mutex);
+            auto it = m_watch_dirs.find(event->wd);
+            std::string path = it == m_watch_dirs.end() ? std::string() : it->second + event->name;
+            if (!path.empty() && (event->mask & IN_ISDIR) && (event->mask & (IN_DELETE | IN_MOVED_FROM))) {
+                // a moved directory keeps its watches under the old prefix, drop them
+                std::string prefix = path + "/";
+                for (auto &dir : m_watch_dirs) {
+                    if (dir.second.compare(0, prefix.size(), prefix) == 0)
+                        inotify_rm_watch(m_inotify_fd, dir.first);
+                }
+            }
+            triggered.resize(m_listeners.size());
+            for (size_t i = 0; i < m_listeners.size(); ++i) {
+                if (!triggered[i] && !path.empty() && path.compare(0, m_listeners[i].first.size(), m_listeners[i].first) == 0) {
+                    triggered[i] = true;
+                    callbacks.push_back(m_listeners[i].second);
+                }
+            }
+            pthread_mutex_unlock(&m_watch_mutex);
+            if (path.empty())
+                continue;
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO))
+                    watchTree(path);
+                dirs.push_back(path + "/");
+            }
+            paths.push_back(path);
+        }
+
+        if (overflow || !paths.empty()) {
+            pthread_rwlock_wrlock(&m_lock);
+            ++m_generation;
+            if (overflow)
+                dropChangedDir(std::string());
+            for (auto &dir : dirs)
+                dropChangedDir(dir);
+            for (auto &path : paths)
+                dropChanged(path);
+            pthread_rwlock_unlock(&m_lock);
+        }
+        for (auto &callback : callbacks)
+            callback();
+    }
+}
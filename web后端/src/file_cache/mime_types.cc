@@ -0,0 +1,121 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "mime_types.h"
+
+static constexpr MimeType mime_types[] = {
+        {"html", "text/html; charset=utf-8", true},
+        {"htm", "text/html; charset=utf-8", true},
+        {"css", "text/css; charset=utf-8", true},
+        {"js", "text/javascript; charset=utf-8", true},
+        {"mjs", "text/javascript; charset=utf-8", true},
+        {"json", "application/json", true},
+        {"map", "application/json", true},
+        {"webmanifest", "application/manifest+json", true},
+        {"xml", "application/xml", true},
+        {"txt", "text/plain; charset=utf-8", true},
+        {"md", "text/markdown; charset=utf-8", true},
+        {"csv", "text/csv; charset=utf-8", true},
+        {"svg", "image/svg+xml", true},
+        {"ico", "image/vnd.microsoft.icon", true},
+        {"wasm", "application/wasm", true},
+        {"jpg", "image/jpeg", false},
+        {"jpeg", "image/jpeg", false},
+        {"png", "image/png", false},
+        {"gif", "image/gif", false},
+        {"webp", "image/webp", false},
+        {"avif", "image/avif", false},
+        {"bmp", "image/bmp", false},
+        {"woff", "font/woff", false},
+        {"woff2", "font/woff2", false},
+        {"ttf", "font/ttf", true},
+        {"otf", "font/otf", true},
+        {"eot", "application/vnd.ms-fontobject", true},
+        {"mp3", "audio/mpeg", false},
+        {"ogg", "audio/ogg", false},
+        {"wav", "audio/wav", false},
+        {"mp4", "video/mp4", false},
+        {"webm", "video/webm", false},
+        {"pdf", "application/pdf", false},
+        {"zip", "application/zip", false},
+        {"gz", "application/gzip", false},
+        {"tar", "application/x-tar", false},
+};
+
+static constexpr MimeType default_type = {"", "application/octet-stream", false};
+
+static constexpr size_t type_count = sizeof(mime_types) / sizeof(mime_types[0]);
+static constexpr size_t slot_count = 256;   // power of two, sparse enough for a seed to exist
+static constexpr size_t max_extension = 12;
+
+static_assert(type_count < 128, "slot holds int8_t index");
+
+// FNV-1a over lower case bytes, seed varied until no slot collides
+static constexpr uint32_t extensionHash(const char *ext, size_t size, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ seed;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= static_cast<unsigned char>(ext[i]);
+        hash *= 16777619u;
+    }
+    return hash ^ (hash >> 15);
+}
+
+static constexpr size_t constLength(const char *s) {
+    size_t size = 0;
+    while (s[size] != '\0')
+        ++size;
+    return size;
+}
+
+struct MimeSlots {
+    int8_t index[slot_count];   // into mime_types, -1 if empty
+    bool perfect;
+};
+
+static constexpr MimeSlots buildSlots(uint32_t seed) {
+    MimeSlots slots{};
+    slots.perfect = true;
+    for (size_t i = 0; i < slot_count; ++i)
+        slots.index[i] = -1;
+    for (size_t i = 0; i < type_count; ++i) {
+        size_t slot = extensionHash(mime_types[i].extension, constLength(mime_types[i].extension), seed) & (slot_count - 1);
+        if (slots.index[slot] != -1)
+            slots.perfect = false;
+        slots.index[slot] = static_cast<int8_t>(i);
+    }
+    return slots;
+}
+
+static constexpr uint32_t findSeed() {
+    uint32_t seed = 0;
+    while (!buildSlots(seed).perfect)
+        ++seed;
+    return seed;
+}
+
+static constexpr uint32_t mime_seed = findSeed();
+static constexpr MimeSlots mime_slots = buildSlots(mime_seed);
+
+const MimeType &mimeType(const char *path) {
+    const char *slash = strrchr(path, '/');
+    const char *dot = strrchr(slash == nullptr ? path : slash, '.');
+    if (dot == nullptr)
+        return default_type;
+    const char *ext = dot + 1;
+    size_t size = strlen(ext);
+    if (size == 0 || size > max_extension)
+        return default_type;
+    char lower[max_extension];
+    for (size_t i = 0; i < size; ++i) {
+        char c = ext[i];
+        lower[i] = c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+    }
+    int index = mime_slots.index[extensionHash(lower, size, mime_seed) & (slot_count - 1)];
+    if (index == -1)
+        return default_type;
+    const MimeType &type = mime_types[index];
+    if (strncmp(type.extension, lower, size) != 0 || type.extension[size] != '\0')
+        return default_type;
+    return type;
+}
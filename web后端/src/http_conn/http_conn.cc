@@ -1,6 +1,8 @@
 #include <string>
-#include <regex>
 
+#include <cerrno>
+#include <climits>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
@@ -12,38 +14,94 @@
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
 
 #include "http_conn.h"
 #include "common.h"
+#include "access_log.h"
+#include "file_cache.h"
+#include "metrics.h"
+#include "resource_picker.h"
+#include "router.h"
 
-std::vector<std::string> HttpConn::resource_filename;
+int HttpConn::max_requests = 100;
+int64_t HttpConn::max_body = 16 * 1024 * 1024;
 
-HttpConn::HttpConn() = default;
+// rest of a body at least this large is spliced to its file
+static const int64_t splice_min = 64 * 1024;
+static const size_t splice_chunk = 64 * 1024;     // default pipe capacity
+// bytes spliced per EPOLLIN, the file side blocks, other conns wait meanwhile
+static const int64_t splice_budget = 4 * splice_chunk;
 
-void HttpConn::init(int remote_fd, const sockaddr_in &address, int epoll_fd) {
-    m_epoll_fd = epoll_fd;
+// multipart/byteranges delimiter, never searched for in bodies
+static const char *range_boundary = "TinyServerByteRanges7f3c9a1e";
+
+HttpConn::HttpConn() : m_loop(nullptr), m_remote_fd(-1), m_conn_id(0), m_remote_ip(0), m_read_ns(0), m_body_type(nullptr), m_range_count(0), m_allow(0), m_request_count(0),
+                       m_body_splice(false), m_body_fd(-1) {
+    m_splice_pipe[0] = m_splice_pipe[1] = -1;
+    init();
+}
+
+void HttpConn::init(int remote_fd, const sockaddr_in &address, ConnLoop *loop, uint64_t conn_id) {
+    m_loop = loop;
     m_remote_fd = remote_fd;
-    addToEpoll(epoll_fd, remote_fd);
+    m_conn_id = conn_id;
+    m_remote_ip = address.sin_addr.s_addr;
+    m_request_count = 0;
+    init();
 }
 
 void HttpConn::init() {
-    memset(m_read_buf, 0, read_buf_size);
-    memset(m_write_header_buf, 0, write_buf_size);
-    m_header_size = 0;
-    m_file_address = nullptr;
-    m_line_ind = 0;
-    m_read_ind = 0;
+    releaseFile();
+    releaseBuffers();
     m_read_end = 0;
-    m_write_vec_count = 0;
-    m_byte_to_send = 0;
-    m_byte_have_send = 0;
+    m_req_start = 0;
+    m_writer.reset();
+    m_resp_count = 0;
+    m_close_after_write = false;
+    resetRequest();
+}
+
+/*
+ * reset parse state for next request starting at m_req_start,
+ * bytes already read are kept
+ */
+void HttpConn::resetRequest() {
+    m_line_ind = m_req_start;
+    m_read_ind = m_req_start;
+    m_src_path_ind = m_req_start;
     m_content_length = 0;
+    m_keep_alive = false;
+    m_headers.clear();
     m_check_state = REQUEST;
+    m_chunked = false;
+    m_chunk_decoder.reset();
+    m_body_size = 0;
+    m_body.clear();
+    m_location.clear();
+    releaseBody();
+}
+
+/*
+ * no ThreadPool room for the request: answer from loop thread
+ * with a constant 503, nothing parsed or allocated
+ */
+void HttpConn::rejectOverload() {
+    static const char resp[] = "HTTP/1.1 503 Service Unavailable\r\n"
+                               "Content-Length: 0\r\nRetry-After: 1\r\nConnection: close\r\n\r\n";
+    Metrics::add(CNT_SYSCALL);
+    ssize_t bytes = send(m_remote_fd, resp, sizeof(resp) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (bytes > 0)
+        Metrics::add(CNT_WRITE_BYTES, static_cast<uint64_t>(bytes));
+    Metrics::addStatus(503);
 }
 
 void HttpConn::closeConn() {
+    Metrics::add(CNT_CLOSE);
+    Metrics::add(CNT_SYSCALL);
     close(m_remote_fd);
-    removeFromEpoll(m_epoll_fd, m_remote_fd);
+    init();
 }
 
 /*
@@ -55,123 +113,374 @@ void HttpConn::closeConn() {
  * return false if bad http request
  */
 bool HttpConn::readReqToBuf() {
+    if (m_body_splice)
+        return spliceBody();
+    ssize_t total = 0;
     while (true) {
+        if (m_read_end == static_cast<ssize_t>(m_read_buf.capacity()) &&
+            !m_read_buf.reserve(m_read_end + 1)) {
+            // buffer is full, parse what we have first,
+            // rest stays in socket until next EPOLLIN re-arm
+            break;
+        }
+        Metrics::add(CNT_SYSCALL);
         ssize_t bytes = read(m_remote_fd,
-                             m_read_buf + m_read_end,
-                             read_buf_size - m_read_end);
+                             m_read_buf.data() + m_read_end,
+                             m_read_buf.capacity() - m_read_end);
         if (bytes == -1) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                // modFd(m_epoll_fd, m_remote_fd, EPOLLIN);
                 // more things to read, waiting for next call.
                 break;
             }
             return false;
         } else if (bytes == 0) {
-            // request size might too big.
+            // client closed
             return false;
         }
         m_read_end += bytes;
+        total += bytes;
     }
+    if (total != 0)
+        m_read_ns = Metrics::nowNs();
+    Metrics::add(CNT_READ_BYTES, total);
     return true;
 }
 
 /*
- * prepare write vec
+ * take bytes a completion based engine received,
+ * caller keeps size within readSpace()
+ */
+bool HttpConn::appendReq(const char *data, size_t size) {
+    if (!m_read_buf.reserve(m_read_end + size))
+        return false;
+    memcpy(m_read_buf.data() + m_read_end, data, size);
+    m_read_end += static_cast<ssize_t>(size);
+    m_read_ns = Metrics::nowNs();
+    Metrics::add(CNT_READ_BYTES, size);
+    return true;
+}
+
+size_t HttpConn::readSpace() {
+    compactReadBuf();
+    return BufferPool::maxSize() - m_read_end;
+}
+
+/*
+ * queue response of current request behind earlier pipelined ones
  */
 bool HttpConn::prepareWrite(HTTP_CODE http_code) {
+    const char *status_code;
     switch (http_code) {
         case INTERNAL_ERROR:
-            addStatusLine("HTTP/1.1", "500");
-            addCRLF();
+            status_code = "500";
             break;
         case BAD_REQUEST:
-            addStatusLine("HTTP/1.1", "400");
-            addCRLF();
+            status_code = "400";
             break;
         case FORBIDDEN_REQUEST:
-            addStatusLine("HTTP/1.1", "403");
-            addCRLF();
+            status_code = "403";
             break;
         case NO_RESOURCE:
-            addStatusLine("HTTP/1.1", "404");
-            addCRLF();
+            status_code = "404";
+            break;
+        case METHOD_NOT_ALLOWED:
+            status_code = "405";
+            break;
+        case CONFLICT:
+            status_code = "409";
             break;
         case FILE_REQUEST:
-            addStatusLine("HTTP/1.1", "200");
-            if (m_content_type == HTML)
-                addHeader("Content-Type", "text/html");
-            else if (m_content_type == IMG_JPG)
-                addHeader("Content-Type", "image/jpeg");
-            else if (m_content_type == IMG_PNG)
-                addHeader("Content-Type", "image/png");
-            if (m_file_stat.st_size != 0) {
-                addHeader("Content-Length", std::to_string(m_file_stat.st_size).c_str());
-                addCRLF();
-                m_write_vec[0].iov_base = m_write_header_buf;
-                m_write_vec[0].iov_len = m_header_size;
-                m_write_vec[1].iov_base = m_file_address;
-                m_write_vec[1].iov_len = m_file_stat.st_size;
-                m_write_vec_count = 2;
-                m_byte_to_send = m_header_size + m_file_stat.st_size;
-                return true;
-            }
-            //addCRLF();
+        case BODY_REQUEST:
+            status_code = "200";
+            break;
+        case CREATED:
+            status_code = "201";
+            break;
+        case PARTIAL_CONTENT:
+            status_code = "206";
+            break;
+        case PAYLOAD_TOO_LARGE:
+            status_code = "413";
+            break;
+        case NOT_MODIFIED:
+            status_code = "304";
+            break;
+        case RANGE_NOT_SATISFIABLE:
+            status_code = "416";
             break;
         default:
             return false;
     }
-    m_write_vec[0].iov_base = m_write_header_buf;
-    m_write_vec[0].iov_len = m_header_size;
-    m_write_vec_count = 1;
+    if (m_resp_count == max_pipeline)
+        return false;
+    if (http_code == PARTIAL_CONTENT && !m_writer.headerFits((m_range_count + 1) * 256 + 512))
+        return false;
+    if (http_code != FILE_REQUEST && http_code != NOT_MODIFIED && !m_writer.headerFits(512))
+        return false;
+
+    // length unknown: chunked, HTTP/1.0 has no chunks, close delimits body
+    bool streamed = http_code == BODY_REQUEST && m_body.streamed();
+    bool chunked = streamed && m_http_version == HTTP_1_1;
+    if (streamed && !chunked && m_http_method != HEAD)
+        m_keep_alive = false;
+    // bad request leaves parser state unknown, never reuse the conn
+    if (http_code == BAD_REQUEST || http_code == INTERNAL_ERROR)
+        m_keep_alive = false;
+    if (m_request_count + 1 >= max_requests)
+        m_keep_alive = false;
+
+    // queued first, the request counts once it is, a failed one leaves queue as it was
+    ResponseWriter::Mark mark = m_writer.mark();
+    if (http_code == PARTIAL_CONTENT) {
+        if (!queueRanges()) {
+            m_writer.rollback(mark);
+            return false;
+        }
+    } else if (http_code == FILE_REQUEST || http_code == NOT_MODIFIED) {
+        // status line and headers are pre-rendered in file cache
+        const std::string &header = http_code == FILE_REQUEST ? m_file->header(m_keep_alive) :
+                                    m_file->notModifiedHeader(m_keep_alive);
+        // HEAD gets same headers as GET, no body, 304 has none either
+        size_t body_size = m_http_method == HEAD || http_code == NOT_MODIFIED ? 0 : m_file->file_stat.st_size;
+        m_writer.queueMemory(header.data(), header.size(), m_file);
+        m_writer.queueFile(std::move(m_file), 0, body_size);
+    } else {
+        // header at append cursor behind earlier ones, generated body follows it
+        size_t body_size = http_code == BODY_REQUEST ? m_body.size() : 0;
+        m_writer.beginHeader(status_code, status_code_map[atoi(status_code)]);
+        if (http_code == BODY_REQUEST) {
+            m_writer.addHeader("Content-Type", m_body_type);
+            m_writer.addHeader("Cache-Control", "no-store");
+        } else if (http_code == RANGE_NOT_SATISFIABLE) {
+            char content_range[48];
+            snprintf(content_range, sizeof(content_range), "bytes */%lld",
+                     static_cast<long long>(m_file->file_stat.st_size));
+            m_writer.addHeader("Content-Range", content_range);
+        } else if (http_code == CREATED) {
+            m_writer.addHeader("Location", m_location.c_str());
+        } else if (http_code == METHOD_NOT_ALLOWED) {
+            char allow[64] = "";
+            for (int method = GET; method <= PATCH; ++method) {
+                if (!(m_allow & (1u << method)))
+                    continue;
+                if (allow[0] != '\0')
+                    strcat(allow, ", ");
+                strcat(allow, methodName(static_cast<HTTP_METHOD>(method)));
+            }
+            m_writer.addHeader("Allow", allow);
+        }
+        if (chunked)
+            m_writer.addHeader("Transfer-Encoding", "chunked");
+        else if (!streamed)
+            m_writer.addHeader("Content-Length", static_cast<long long>(body_size));
+        m_writer.addHeader("Connection", m_keep_alive ? "keep-alive" : "close");
+        if (!m_writer.endHeader())
+            return false;
+        if (m_http_method != HEAD && http_code == BODY_REQUEST)
+            m_writer.queueBody(m_body, chunked);
+        m_body.clear();
+        m_file.reset();
+    }
+
+    ++m_request_count;
+    if (!m_keep_alive)
+        m_close_after_write = true;
+    Metrics::add(CNT_REQUEST);
+    Metrics::addStatus(atoi(status_code));
+    ++m_resp_count;
+    // access log counts header and known body bytes
+    logRequest(atoi(status_code), static_cast<ssize_t>(m_writer.queuedBytes() - mark.queued));
+    return true;
+}
+
+/*
+ * queue 206 of m_file: part headers and delimiters of multipart/byteranges
+ * are copied at header cursor between slices of the file.
+ * false if they overflow header buffer, caller rolls queue back
+ */
+bool HttpConn::queueRanges() {
+    const CachedFile &file = *m_file;
+    long long length = static_cast<long long>(file.file_stat.st_size);
+    bool multipart = m_range_count > 1;
+    char line[160];
+
+    // part headers first, their size counts in Content-Length
+    std::string parts[max_ranges];
+    long long content_length = 0;
+    for (int i = 0; i < m_range_count; ++i) {
+        long long first = m_ranges[i].first;
+        long long last = m_ranges[i].last;
+        if (multipart) {
+            snprintf(line, sizeof(line), "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                     range_boundary, file.content_type, first, last, length);
+            parts[i] = line;
+            content_length += static_cast<long long>(parts[i].size());
+        }
+        content_length += last - first + 1;
+    }
+    std::string closing;
+    if (multipart) {
+        closing = std::string("\r\n--") + range_boundary + "--\r\n";
+        content_length += static_cast<long long>(closing.size());
+    }
+
+    m_writer.beginHeader("206", status_code_map[206]);
+    if (multipart) {
+        snprintf(line, sizeof(line), "multipart/byteranges; boundary=%s", range_boundary);
+        m_writer.addHeader("Content-Type", line);
+    } else {
+        m_writer.addHeader("Content-Type", file.content_type);
+        snprintf(line, sizeof(line), "bytes %lld-%lld/%lld", static_cast<long long>(m_ranges[0].first),
+                 static_cast<long long>(m_ranges[0].last), length);
+        m_writer.addHeader("Content-Range", line);
+    }
+    m_writer.addLines(file.entity_headers);
+    m_writer.addHeader("Content-Length", content_length);
+    m_writer.addHeader("Connection", m_keep_alive ? "keep-alive" : "close");
+    if (!m_writer.endHeader())
+        return false;
+
+    for (int i = 0; i < m_range_count; ++i) {
+        if (multipart && !m_writer.queueCopy(parts[i].data(), parts[i].size()))
+            return false;
+        m_writer.queueFile(m_file, static_cast<off_t>(m_ranges[i].first),
+                           static_cast<size_t>(m_ranges[i].last - m_ranges[i].first + 1));
+    }
+    if (multipart && !m_writer.queueCopy(closing.data(), closing.size()))
+        return false;
+    m_file.reset();
     return true;
 }
 
 /*
  * write prepared data to client
  * called when register and trigger EPOLLOUT
+ *
+ * return true if conn should be kept
+ * return false if conn should be closed
  */
 bool HttpConn::writeResp() {
-    while (true) {
-        ssize_t bytes = writev(m_remote_fd, m_write_vec, m_write_vec_count);
-        if (bytes == -1) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                // modFd(m_epoll_fd, m_remote_fd, EPOLLOUT);
-                return true;
+    {
+        // only sending is timed, requests parsed below are timed by themselves
+        ScopedTimer timer(HIST_WRITE);
+        while (writePending()) {
+            Metrics::add(CNT_SYSCALL);
+            ssize_t bytes = fileBodyNext() ? sendFileBody() : sendVec();
+            if (bytes == 0) {
+                // file shrank under sendfile()
+                return false;
             }
-            // send file error
-            unmap();
-            return false;
+            if (bytes == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    // wait for next EPOLLOUT, a stream is not pulled meanwhile
+                    m_loop->waitWrite(this);
+                    return true;
+                }
+                return false;
+            }
+            consumeSent(bytes);
         }
+    }
+    if (m_writer.stalled()) {
+        // stream had nothing, conn waits unarmed for its waker, see BodySource
+        return true;
+    }
+    return finishWrite();
+}
 
-        m_byte_have_send += bytes;
-        m_byte_to_send -= bytes;
-        if (m_byte_have_send < m_write_vec[0].iov_len) {
-            // vec[0] has been sent incompletely
-            m_write_vec[0].iov_base = m_write_header_buf + m_byte_have_send;
-            m_write_vec[0].iov_len = m_write_vec[0].iov_len - m_byte_have_send;
-        } else {
-            // vec[0] send complete
-            m_write_vec[0].iov_len = 0;
-            m_write_vec[1].iov_base = m_file_address +
-                                      (m_byte_have_send - m_header_size);
-            m_write_vec[1].iov_len = m_byte_to_send;
-        }
+/*
+ * called when every queued response is sent, requests read ahead
+ * meanwhile go to loop like freshly read ones, else wait for more.
+ *
+ * return false if conn should be closed
+ */
+bool HttpConn::finishWrite() {
+    m_resp_count = 0;
+    m_writer.reset();
+    if (m_close_after_write)
+        return false;
+
+    // keep partial request read ahead, loop decides where to run complete ones
+    compactReadBuf();
+    if (m_read_end != 0) {
+        m_loop->dispatch(this);
+        return true;
+    }
+    m_read_buf.release();
 
-        if (m_byte_to_send <= 0) {
-            // send file success
-            unmap();
-            modFd(m_epoll_fd, m_remote_fd, EPOLLIN);
-            init();
+    // consistent connection, idle one is closed by timer
+    m_loop->waitRead(this);
+    return true;
+}
 
-            // enable consistent connection
-            // return true;
+// front segment by sendfile(), from where last step stopped
+ssize_t HttpConn::sendFileBody() {
+    return m_writer.sendFile(m_remote_fd);
+}
 
-            // disable consistent connection
-            // for preventing fd leaks
-            // TODO: implement timer to close inactive connection
-            //  to make consistent connection possible.
-            return false;
+/*
+ * gather queued segments into one sendmsg(), up to a sendfile() one
+ * or IOV_MAX. MSG_MORE if bytes follow, so a header shares packet with body.
+ */
+ssize_t HttpConn::sendVec() {
+    bool more = false;
+    int count = buildWriteVec(more);
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = const_cast<struct iovec *>(m_writer.vec());
+    msg.msg_iovlen = count;
+    return sendmsg(m_remote_fd, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+}
+
+int HttpConn::buildWriteVec(bool &more) {
+    return m_writer.buildVec(more);
+}
+
+void HttpConn::consumeSent(ssize_t bytes) {
+    Metrics::add(CNT_WRITE_BYTES, bytes);
+    m_writer.consume(static_cast<size_t>(bytes));
+}
+
+/*
+ * move unparsed bytes after m_req_start to buffer front,
+ * parse state of a partial request moves with them
+ */
+void HttpConn::compactReadBuf() {
+    if (m_req_start == 0)
+        return;
+    char *buf = m_read_buf.data();
+    memmove(buf, buf + m_req_start, m_read_end - m_req_start);
+    m_read_end -= m_req_start;
+    m_read_ind -= m_req_start;
+    m_line_ind -= m_req_start;
+    m_src_path_ind -= m_req_start;
+    m_headers.shift(static_cast<int32_t>(-m_req_start));
+    m_req_start = 0;
+}
+
+/*
+ * parse every complete request in buffer and queue its response,
+ * stop at a partial request, a full queue or a response closing conn
+ */
+void HttpConn::processRequests() {
+    ScopedTimer timer(HIST_PARSE);
+    // a stream is last in queue, requests behind it wait until it is sent
+    while (m_resp_count < max_pipeline && !m_close_after_write && !m_writer.streaming()) {
+        HTTP_CODE code = parseReq();
+        if (code == NO_REQUEST) {
+            if (m_req_start == 0 && m_read_end == static_cast<ssize_t>(BufferPool::maxSize())) {
+                // single request larger than biggest buffer
+                prepareWrite(BAD_REQUEST);
+            }
+            break;
         }
+        if (!prepareWrite(code))
+            prepareWrite(INTERNAL_ERROR);
+
+        // next request starts right behind this one
+        m_req_start = m_read_ind;
+        resetRequest();
     }
 }
 
@@ -180,21 +489,19 @@ bool HttpConn::writeResp() {
  */
 HTTP_CODE HttpConn::parseReq() {
     LINE_STATE line_state = LINE_OK;
-    HTTP_CODE http_state = NO_REQUEST;
-    while ((line_state = parseLine()) == LINE_OK) {
+    while (m_check_state < BODY && (line_state = parseLine()) == LINE_OK) {
         switch (m_check_state) {
             // except push state by parse* function
             case REQUEST:
                 if (parseReqLine(getLine()) == BAD_REQUEST)
                     return BAD_REQUEST;
                 break;
-            case HEADER:
-                if (parseHeaders(getLine()) == BAD_REQUEST)
-                    return BAD_REQUEST;
-                break;
-            case CONTENT:
-                // parse content, decide what kind of data to send.
+            case HEADER: {
+                HTTP_CODE code = parseHeaders(getLine());
+                if (code != NO_REQUEST)
+                    return code;
                 break;
+            }
             default:
                 return BAD_REQUEST;
         }
@@ -202,180 +509,533 @@ HTTP_CODE HttpConn::parseReq() {
 
     if (line_state == LINE_BAD)
         return BAD_REQUEST;
-    else
-        return parseContent();
+    if (m_check_state == BODY) {
+        HTTP_CODE code = parseBody();
+        if (code != NO_REQUEST)
+            return code;
+    }
+    if (m_check_state != CONTENT) {
+        // request not complete yet
+        return NO_REQUEST;
+    }
+    return parseContent();
 }
 
 /*
  * parse one line and move m_read_ind for buffer
  */
 LINE_STATE HttpConn::parseLine() {
-    for (; m_read_ind < m_read_end; ++m_read_ind) {
-        if (m_read_buf[m_read_ind] == '\r') {
-            if (m_read_ind + 1 == m_read_end)
-                return LINE_OPEN;
-            if (m_read_buf[m_read_ind + 1] == '\n') {
-                m_read_buf[m_read_ind++] = '\0';
-                m_read_buf[m_read_ind++] = '\0';
-                return LINE_OK;
-            } else {
-                return LINE_BAD;
-            }
-        } else if (m_read_buf[m_read_ind] == '\n') {
-            if (m_read_ind >= 1 && m_read_buf[m_read_ind - 1] == '\r') {
-                m_read_buf[m_read_ind - 1] = '\0';
-                m_read_buf[m_read_ind++] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
-        }
+    char *buf = m_read_buf.data();
+    const char *end = buf + m_read_end;
+    const char *p = findAnyOf2(buf + m_read_ind, end, '\r', '\n');
+    m_read_ind = p - buf;
+    if (p == end || p + 1 == end)
+        return LINE_OPEN;
+    if (*p == '\n' || *(p + 1) != '\n') {
+        // bare LF or CR
+        return LINE_BAD;
     }
-    return LINE_OPEN;
+    buf[m_read_ind++] = '\0';
+    buf[m_read_ind++] = '\0';
+    return LINE_OK;
 }
 
 /*
  * parse status line after a complete line parsed by parseContent()
  */
 HTTP_CODE HttpConn::parseReqLine(char *line) {
-    std::cmatch matcher;
-    if (!std::regex_match(line, matcher, req_re))
+    RequestLine req_line;
+    if (!parseRequestLine(line, strlen(line), req_line))
         return BAD_REQUEST;
 
-    m_http_method = line;
-    *const_cast<char *>(matcher[1].second) = '\0';
-    m_src_path = const_cast<char *>(matcher[2].first);
-    *const_cast<char *>(matcher[2].second) = '\0';
-    m_http_version = const_cast<char *>(matcher[3].first);
+    m_http_method = req_line.method;
+    m_src_path_ind = req_line.target.data - m_read_buf.data();
+    line[req_line.target.data - line + req_line.target.size] = '\0';
+    m_http_version = req_line.version;
+    // HTTP/1.1 keeps conn alive by default, HTTP/1.0 only if asked
+    m_keep_alive = m_http_version == HTTP_1_1;
 
     m_check_state = HEADER;
     return NO_REQUEST;
 }
 
 /*
- * parse header of http request
- * such as content-type or content-length
+ * parse header of http request, known headers are stored
+ * in m_headers as offsets into m_read_buf.
  */
 HTTP_CODE HttpConn::parseHeaders(char *line) {
     if (*line == '\0' && *(line + 1) == '\0') {
         m_check_state = CONTENT;
-    } else if (strncasecmp(line, "Content-Length:", 15) == 0) {
-        line += 15;
-        line += strspn(line, " \t");
-        m_content_length = atoi(line);
+        return beginBody();
+    }
+
+    const char *end = line + strlen(line);
+    const char *colon = findAnyOf2(line, end, ':', ':');
+    if (colon == end || colon == line)
+        return BAD_REQUEST;
+    HEADER_ID id = matchHeaderName(line, colon - line);
+    if (id == HDR_COUNT)
+        return NO_REQUEST;
+
+    // trim optional white space around value
+    const char *value = colon + 1;
+    while (value < end && (*value == ' ' || *value == '\t'))
+        ++value;
+    while (end > value && (*(end - 1) == ' ' || *(end - 1) == '\t'))
+        --end;
+    m_headers.set(id, static_cast<int32_t>(value - m_read_buf.data()), static_cast<int32_t>(end - value));
+
+    switch (id) {
+        case HDR_CONNECTION:
+            if (strncasecmp(value, "close", 5) == 0)
+                m_keep_alive = false;
+            else if (strncasecmp(value, "keep-alive", 10) == 0)
+                m_keep_alive = true;
+            break;
+        default:
+            break;
     }
     return NO_REQUEST;
 }
 
 /*
- * parse content and return type of content that client expect
+ * request is complete, its route handler builds the response
  */
 HTTP_CODE HttpConn::parseContent() {
-    if (m_content_length == 0) {
-        if (strcmp(m_src_path, "/") == 0) {
-            m_content_type = HTML;
-            return prepareFile("index.html");
-        } else if (strcmp(m_src_path, "/funny_box.html") == 0) {
-            m_content_type = HTML;
-            return prepareFile("funny_box.html");
-        } else if (strcmp(m_src_path, "/random_funny") == 0) {
-            std::string &filename = resource_filename[distribution(file_no_e) % resource_filename.size()];
-            if (filename.substr(filename.size() - 4) == ".jpg")
-                m_content_type = IMG_JPG;
-            else if (filename.substr(filename.size() - 4) == ".png")
-                m_content_type = IMG_PNG;
-            return prepareFile(("funny_mystery_box/" + filename).c_str());
-        } else {
+    const char *src_path = m_read_buf.data() + m_src_path_ind;
+    RouteMatch match;
+    switch (Router::instance().match(m_http_method, src_path, strlen(src_path), match)) {
+        case ROUTE_FOUND:
+            return match.route->handler(*this, match);
+        case ROUTE_BAD_METHOD:
+            m_allow = match.allow;
+            return METHOD_NOT_ALLOWED;
+        default:
             return NO_RESOURCE;
+    }
+}
+
+HTTP_CODE HttpConn::respondFile(const char *filename) {
+    return prepareFile(filename);
+}
+
+HTTP_CODE HttpConn::respondCached(std::shared_ptr<const CachedFile> file) {
+    m_file = std::move(file);
+    FileCache::selectVariant(m_file, acceptEncodings());
+    return prepareCachedFile();
+}
+
+HTTP_CODE HttpConn::respondBody(std::string body, const char *content_type) {
+    respondWith(content_type).append(std::move(body));
+    return BODY_REQUEST;
+}
+
+ResponseBody &HttpConn::respondWith(const char *content_type) {
+    m_body.clear();
+    m_body_type = content_type;
+    return m_body;
+}
+
+// by id, a waker called after conn closed or was reused does nothing
+std::function<void()> HttpConn::streamWaker() const {
+    ConnLoop *loop = m_loop;
+    uint64_t conn_id = m_conn_id;
+    return [loop, conn_id] { loop->wakeStream(conn_id); };
+}
+
+/*
+ * after headers: pick body framing and where body goes.
+ * what would be refused anyway is refused before body is read,
+ * that body stays unread so conn is closed after response.
+ */
+HTTP_CODE HttpConn::beginBody() {
+    bool has_length = m_headers.has(HDR_CONTENT_LENGTH);
+    m_content_length = 0;
+    if (m_headers.has(HDR_TRANSFER_ENCODING)) {
+        // chunked only, with Content-Length as well framing is ambiguous
+        const HeaderTable::Slice &slice = m_headers.slices[HDR_TRANSFER_ENCODING];
+        if (has_length || slice.size != 7 || strncasecmp(m_read_buf.data() + slice.offset, "chunked", 7) != 0)
+            return BAD_REQUEST;
+        m_chunked = true;
+    } else if (has_length) {
+        const HeaderTable::Slice &slice = m_headers.slices[HDR_CONTENT_LENGTH];
+        m_content_length = parseContentLength(m_read_buf.data() + slice.offset, slice.size);
+        if (m_content_length < 0)
+            return BAD_REQUEST;
+    }
+    HTTP_CODE code = m_content_length > max_body ? PAYLOAD_TOO_LARGE : beginRoute();
+    if (code != NO_REQUEST) {
+        m_keep_alive = false;
+        return code;
+    }
+    if (!m_chunked && m_content_length == 0)
+        return NO_REQUEST;
+
+    // client holding body back for an interim answer, unless responses are queued before it
+    if (m_headers.has(HDR_EXPECT) && m_resp_count == 0) {
+        const HeaderTable::Slice &slice = m_headers.slices[HDR_EXPECT];
+        if (slice.size == 12 && strncasecmp(m_read_buf.data() + slice.offset, "100-continue", 12) == 0) {
+            // queued alone, run() waits for write before reading body
+            m_writer.beginHeader("100", "Continue");
+            m_writer.endHeader();
         }
     }
-    // more things to do
-    return BAD_REQUEST;
+    m_check_state = BODY;
+    return NO_REQUEST;
+}
+
+/*
+ * take body bytes read so far. bytes of a body not complete yet
+ * are dropped from read buffer, headers in front of them stay.
+ */
+HTTP_CODE HttpConn::parseBody() {
+    char *data = m_read_buf.data() + m_read_ind;
+    auto avail = static_cast<size_t>(m_read_end - m_read_ind);
+    size_t consumed;
+    size_t size;
+    if (m_chunked) {
+        consumed = m_chunk_decoder.decode(data, avail, size);
+        if (m_chunk_decoder.bad())
+            return BAD_REQUEST;
+    } else {
+        size = static_cast<int64_t>(avail) < m_content_length ? avail : static_cast<size_t>(m_content_length);
+        consumed = size;
+        m_content_length -= static_cast<int64_t>(size);
+    }
+    m_body_size += static_cast<int64_t>(size);
+    if (m_body_size > max_body) {
+        m_keep_alive = false;
+        return PAYLOAD_TOO_LARGE;
+    }
+    if (!storeBody(data, size))
+        return INTERNAL_ERROR;
+
+    if (m_chunked ? m_chunk_decoder.done() : m_content_length == 0) {
+        m_read_ind += static_cast<ssize_t>(consumed);
+        m_check_state = CONTENT;
+        return NO_REQUEST;
+    }
+    m_read_end = m_read_ind;
+    // large rest of a stored body goes around user space
+    if (!m_chunked && m_body_fd != -1 && m_content_length >= splice_min)
+        m_body_splice = true;
+    return NO_REQUEST;
+}
+
+bool HttpConn::storeBody(const char *data, size_t size) {
+    if (m_body_fd == -1)
+        return true;
+    while (size > 0) {
+        Metrics::add(CNT_SYSCALL);
+        ssize_t bytes = write(m_body_fd, data, size);
+        if (bytes == -1) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += bytes;
+        size -= static_cast<size_t>(bytes);
+    }
+    return true;
+}
+
+/*
+ * called by readReqToBuf() instead of reading while m_body_splice:
+ * socket -> pipe -> body file, body bytes never enter user space.
+ * stops at EAGAIN, at end of body or after splice_budget bytes,
+ * the rest wakes EPOLLIN again on re-arm. bytes behind body stay in socket.
+ */
+bool HttpConn::spliceBody() {
+    if (m_splice_pipe[0] == -1 && pipe2(m_splice_pipe, O_NONBLOCK | O_CLOEXEC) == -1)
+        return false;
+    int64_t total = 0;
+    while (m_content_length > 0 && total < splice_budget) {
+        size_t want = m_content_length < static_cast<int64_t>(splice_chunk) ?
+                      static_cast<size_t>(m_content_length) : splice_chunk;
+        Metrics::add(CNT_SYSCALL);
+        ssize_t bytes = splice(m_remote_fd, nullptr, m_splice_pipe[1], nullptr, want,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (bytes <= 0)
+            return false;
+        for (ssize_t left = bytes; left > 0;) {
+            Metrics::add(CNT_SYSCALL);
+            ssize_t moved = splice(m_splice_pipe[0], nullptr, m_body_fd, nullptr,
+                                   static_cast<size_t>(left), SPLICE_F_MOVE);
+            if (moved == -1 && errno == EINTR)
+                continue;
+            if (moved <= 0)
+                return false;
+            left -= moved;
+        }
+        m_content_length -= bytes;
+        m_body_size += bytes;
+        total += bytes;
+    }
+    if (total != 0)
+        m_read_ns = Metrics::nowNs();
+    Metrics::add(CNT_READ_BYTES, static_cast<uint64_t>(total));
+    if (m_content_length == 0) {
+        // parseBody() finishes request on next run()
+        m_body_splice = false;
+        close(m_splice_pipe[0]);
+        close(m_splice_pipe[1]);
+        m_splice_pipe[0] = m_splice_pipe[1] = -1;
+    }
+    return true;
+}
+
+/*
+ * route of target decides where body goes, before it is read: its
+ * body handler may call receiveBodyTo() or refuse the request.
+ * a body no route takes is discarded. GET and HEAD bodies are never
+ * stored, their route is only matched by parseContent().
+ */
+HTTP_CODE HttpConn::beginRoute() {
+    if (m_http_method == GET || m_http_method == HEAD)
+        return NO_REQUEST;
+    const char *target = m_read_buf.data() + m_src_path_ind;
+    RouteMatch match;
+    if (Router::instance().match(m_http_method, target, strlen(target), match) != ROUTE_FOUND ||
+        !match.route->body)
+        return NO_REQUEST;
+    return match.route->body(*this, match);
+}
+
+HTTP_CODE HttpConn::receiveBodyTo(const std::string &path) {
+    releaseBody();
+    Metrics::add(CNT_SYSCALL);
+    m_body_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_body_fd == -1)
+        return INTERNAL_ERROR;
+    m_body_path = path;
+    return NO_REQUEST;
+}
+
+std::string HttpConn::takeBodyFile() {
+    std::string path;
+    path.swap(m_body_path);
+    releaseBody();
+    return path;
+}
+
+HTTP_CODE HttpConn::respondCreated(std::string location) {
+    m_location = std::move(location);
+    return CREATED;
+}
+
+// drop body file of an unfinished request
+void HttpConn::releaseBody() {
+    if (m_body_fd != -1) {
+        close(m_body_fd);
+        m_body_fd = -1;
+    }
+    if (m_splice_pipe[0] != -1) {
+        close(m_splice_pipe[0]);
+        close(m_splice_pipe[1]);
+        m_splice_pipe[0] = m_splice_pipe[1] = -1;
+    }
+    if (!m_body_path.empty()) {
+        unlink(m_body_path.c_str());
+        m_body_path.clear();
+    }
+    m_body_splice = false;
+}
+
+/*
+ * guess from the first request line in read buffer, not parsing it,
+ * whether run() is cheap: a GET/HEAD of a route not marked offload
+ * whose file, if any, is cached or known missing, or an error. file cache misses,
+ * including static files under /*path, offload routes (e.g. /__stats)
+ * and requests in the middle of parse (e.g. waiting for body) are not.
+ */
+bool HttpConn::cheapRequest() const {
+    if (m_check_state != REQUEST)
+        return false;
+    const char *begin = m_read_buf.data() + m_req_start;
+    const char *end = m_read_buf.data() + m_read_end;
+    if (begin == end)
+        return true;
+    auto eol = static_cast<const char *>(memchr(begin, '\n', end - begin));
+    if (eol == nullptr)
+        return true;    // partial, run() only waits for the rest
+    size_t size = eol - begin;
+    if (size != 0 && eol[-1] == '\r')
+        --size;
+    RequestLine req_line;
+    if (!parseRequestLine(begin, size, req_line))
+        return true;    // 400
+    if (req_line.method != GET && req_line.method != HEAD)
+        return false;
+    RouteMatch match;
+    if (Router::instance().match(req_line.method, req_line.target.data, req_line.target.size, match) != ROUTE_FOUND)
+        return true;    // 404 or 405
+    if (match.route->offload)
+        return false;
+    if (match.route->file != nullptr)
+        return FileCache::instance().contains(match.route->file);
+    // any file under root, normalized as serveStatic() does
+    StrView rest = match.param("path");
+    if (rest.data == nullptr)
+        return true;
+    char path[PATH_MAX];
+    if (normalizePath(rest.data, rest.size, "index.html", path, sizeof(path)) != PATH_OK)
+        return true;    // 400 or 403
+    return FileCache::instance().contains(path);
+}
+
+unsigned HttpConn::acceptEncodings() const {
+    if (!m_headers.has(HDR_ACCEPT_ENCODING))
+        return 1u << ENC_IDENTITY;
+    const HeaderTable::Slice &slice = m_headers.slices[HDR_ACCEPT_ENCODING];
+    return parseAcceptEncoding(m_read_buf.data() + slice.offset, slice.size);
 }
 
 HTTP_CODE HttpConn::prepareFile(const char *filename) {
-    if (stat(filename, &m_file_stat) < 0)
-        return NO_RESOURCE;
-    if (!(m_file_stat.st_mode & S_IROTH))
-        return FORBIDDEN_REQUEST;
-    if (S_ISDIR(m_file_stat.st_mode))
-        return BAD_REQUEST;
-    int fd = open(filename, O_RDONLY);
-    m_file_address =
-            reinterpret_cast<char *>(mmap(nullptr, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
-    close(fd);
-    return FILE_REQUEST;
+    HTTP_CODE ret = FileCache::instance().get(filename, acceptEncodings(), m_file);
+    if (ret != FILE_REQUEST)
+        return ret;
+    return prepareCachedFile();
+}
+
+/*
+ * conditional and range headers against m_file
+ */
+HTTP_CODE HttpConn::prepareCachedFile() {
+    // If-Modified-Since only counts without If-None-Match
+    if (m_headers.has(HDR_IF_NONE_MATCH)) {
+        const HeaderTable::Slice &slice = m_headers.slices[HDR_IF_NONE_MATCH];
+        if (matchETag(m_read_buf.data() + slice.offset, slice.size, m_file->etag.data(), m_file->etag.size()))
+            return NOT_MODIFIED;
+    } else if (m_headers.has(HDR_IF_MODIFIED_SINCE)) {
+        const HeaderTable::Slice &slice = m_headers.slices[HDR_IF_MODIFIED_SINCE];
+        time_t since = parseHttpDate(m_read_buf.data() + slice.offset, slice.size);
+        if (since != -1 && m_file->mtime <= since)
+            return NOT_MODIFIED;
+    }
+    return prepareRange();
+}
+
+/*
+ * Range of a GET on m_file, whole file if Range is absent, malformed,
+ * If-Range does not match or parts would not fit response queue
+ */
+HTTP_CODE HttpConn::prepareRange() {
+    if (m_http_method != GET || !m_headers.has(HDR_RANGE))
+        return FILE_REQUEST;
+    if (m_headers.has(HDR_IF_RANGE)) {
+        // strong etag or exact Last-Modified
+        const HeaderTable::Slice &slice = m_headers.slices[HDR_IF_RANGE];
+        const char *value = m_read_buf.data() + slice.offset;
+        bool match = static_cast<size_t>(slice.size) == m_file->etag.size() &&
+                     memcmp(value, m_file->etag.data(), slice.size) == 0;
+        if (!match && value[0] != '"' && value[0] != 'W')
+            match = parseHttpDate(value, slice.size) == m_file->mtime;
+        if (!match)
+            return FILE_REQUEST;
+    }
+
+    const HeaderTable::Slice &slice = m_headers.slices[HDR_RANGE];
+    RANGE_RESULT result = parseRange(m_read_buf.data() + slice.offset, slice.size, m_file->file_stat.st_size,
+                                     m_ranges, max_ranges, m_range_count);
+    if (result == RANGE_UNSATISFIABLE)
+        return RANGE_NOT_SATISFIABLE;
+    if (result != RANGE_OK)
+        return FILE_REQUEST;
+    return PARTIAL_CONTENT;
 }
 
 /*
  * get one line from m_read_buf and move m_line_ind to next
  */
 inline char *HttpConn::getLine() {
-    char *t = m_read_buf + m_line_ind;
+    char *t = m_read_buf.data() + m_line_ind;
     m_line_ind += strlen(t) + 2;
     return t;
 }
 
-void HttpConn::unmap() {
-    if (m_file_address != nullptr) {
-        munmap(m_file_address, m_file_stat.st_size);
-        m_file_address = nullptr;
+/*
+ * drop reference of cached file, unmapped by cache when last one gone
+ */
+void HttpConn::releaseFile() {
+    m_file.reset();
+}
+
+void HttpConn::releaseBuffers() {
+    m_read_buf.release();
+}
+
+/*
+ * push record of current request to access log,
+ * called before parse state is reset for next request
+ */
+void HttpConn::logRequest(int status, ssize_t bytes) {
+    AccessRecord *record = AccessLog::instance().claim();
+    if (record == nullptr)
+        return;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    record->time_ns = static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+    record->bytes = static_cast<uint64_t>(bytes);
+    record->latency_us = static_cast<uint32_t>((Metrics::nowNs() - m_read_ns) / 1000);
+    record->remote_ip = m_remote_ip;
+    record->status = static_cast<uint16_t>(status);
+    if (m_check_state == REQUEST) {
+        // request line never parsed
+        record->method = AccessRecord::no_method;
+        record->path_size = 0;
+    } else {
+        const char *path = m_read_buf.data() + m_src_path_ind;
+        size_t size = strnlen(path, sizeof(record->path));
+        memcpy(record->path, path, size);
+        record->method = static_cast<uint8_t>(m_http_method);
+        record->version = static_cast<uint8_t>(m_http_version);
+        record->path_size = static_cast<uint16_t>(size);
     }
+    AccessLog::instance().commit();
 }
 
 /*
  * called after readReqToBuf()
- * parse http request
+ * parse every complete http request in buffer
  */
 void HttpConn::run() {
-    HTTP_CODE code = parseReq();
-    if (code == NO_REQUEST) {
+    processRequests();
+    // last touch of conn: with epoll, a worker gives conn back here.
+    // a 100 Continue may be queued without any response
+    if (m_resp_count == 0 && m_writer.queuedBytes() == 0) {
+        // wait for rest of request
+        m_loop->waitRead(this);
         return;
     }
-
-    if (!prepareWrite(code))
-        closeConn();
     // prepared to write
-    modFd(m_epoll_fd, m_remote_fd, EPOLLOUT);
-}
-
-// common functions
-void HttpConn::addCRLF() {
-    strcat(m_write_header_buf, "\r\n");
-    m_header_size += 2;
+    m_loop->waitWrite(this);
 }
 
-void HttpConn::addStatusLine(const char *version, const char *status_code) {
-    strcat(m_write_header_buf, version);
-    strcat(m_write_header_buf, " ");
-    strcat(m_write_header_buf, status_code);
-    strcat(m_write_header_buf, " ");
-    const char *status_msg = status_code_map[atoi(status_code)];
-    strcat(m_write_header_buf, status_msg);
-    m_header_size += strlen(version) + strlen(status_code) +
-                     strlen(status_msg) + 2;
-    addCRLF();
+/*
+ * called by TimerWheel in main loop thread
+ * when conn is inactive for too long
+ */
+void HttpConn::onTimeout() {
+    m_loop->dropConn(this);
 }
 
-void HttpConn::addHeader(const char *key, const char *value) {
-    strcat(m_write_header_buf, key);
-    strcat(m_write_header_buf, ": ");
-    strcat(m_write_header_buf, value);
-    m_header_size += strlen(key) + strlen(value) + 2;
-    addCRLF();
+void HttpConn::setMaxRequests(int max_requests) {
+    HttpConn::max_requests = max_requests;
 }
 
-void HttpConn::addResourceFile(const char *filename) {
-    resource_filename.emplace_back(filename);
+void HttpConn::setMaxBody(int64_t max_body) {
+    HttpConn::max_body = max_body;
 }
 
 void HttpConn::prepareResource() {
-    DIR *resource_dir;
-    if ((resource_dir = opendir("funny_mystery_box")) == nullptr)
+    if (!ResourcePicker::instance().load("funny_mystery_box"))
         exit(1);
-    struct dirent *ptr;
-    while ((ptr = readdir(resource_dir)) != nullptr) {
-        if (ptr->d_type == DT_REG)
-            addResourceFile(ptr->d_name);
-    }
-    closedir(resource_dir);
+    // cached files are dropped once changed on disk, anywhere under root
+    FileCache::instance().watch(".");
+    // new table once a file there is added, removed or changed
+    FileCache::instance().onChange("funny_mystery_box/", [] {
+        ResourcePicker::instance().load("funny_mystery_box");
+    });
 }
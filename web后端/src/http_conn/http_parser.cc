@@ -0,0 +1,618 @@
+#include <cstring>
+#include <ctime>
+#include <strings.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "http_parser.h"
+
+static const char *method_names[] = {
+        "GET", "POST", "HEAD", "PUT", "DELETE", "CONNECT", "OPTIONS", "TRACE", "PATCH",
+};
+
+const char *methodName(HTTP_METHOD method) {
+    return method_names[method];
+}
+
+/*
+ * match method token by length and first byte,
+ * then compare the rest once.
+ */
+static bool matchMethod(const char *token, size_t size, HTTP_METHOD &method) {
+    switch (size) {
+        case 3:
+            if (memcmp(token, "GET", 3) == 0) {
+                method = GET;
+                return true;
+            }
+            if (memcmp(token, "PUT", 3) == 0) {
+                method = PUT;
+                return true;
+            }
+            return false;
+        case 4:
+            if (memcmp(token, "POST", 4) == 0) {
+                method = POST;
+                return true;
+            }
+            if (memcmp(token, "HEAD", 4) == 0) {
+                method = HEAD;
+                return true;
+            }
+            return false;
+        case 5:
+            if (token[0] == 'T' && memcmp(token, "TRACE", 5) == 0) {
+                method = TRACE;
+                return true;
+            }
+            if (token[0] == 'P' && memcmp(token, "PATCH", 5) == 0) {
+                method = PATCH;
+                return true;
+            }
+            return false;
+        case 6:
+            if (memcmp(token, "DELETE", 6) == 0) {
+                method = DELETE;
+                return true;
+            }
+            return false;
+        case 7:
+            if (token[0] == 'O' && memcmp(token, "OPTIONS", 7) == 0) {
+                method = OPTIONS;
+                return true;
+            }
+            if (token[0] == 'C' && memcmp(token, "CONNECT", 7) == 0) {
+                method = CONNECT;
+                return true;
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+bool parseRequestLine(const char *line, size_t size, RequestLine &req_line) {
+    const char *end = line + size;
+    const char *p = line;
+
+    // method, upper case token ended by SP
+    while (p < end && *p >= 'A' && *p <= 'Z')
+        ++p;
+    if (p == end || *p != ' ' || !matchMethod(line, p - line, req_line.method))
+        return false;
+
+    // request target, visible chars ended by SP
+    const char *target = ++p;
+    while (p < end && static_cast<unsigned char>(*p) > ' ' && *p != 0x7f)
+        ++p;
+    if (p == target || p == end || *p != ' ')
+        return false;
+    req_line.target.data = target;
+    req_line.target.size = p - target;
+
+    // version, exactly "HTTP/1.0" or "HTTP/1.1" up to end of line
+    ++p;
+    if (end - p != 8 || memcmp(p, "HTTP/1.", 7) != 0)
+        return false;
+    if (p[7] == '1')
+        req_line.version = HTTP_1_1;
+    else if (p[7] == '0')
+        req_line.version = HTTP_1_0;
+    else
+        return false;
+    return true;
+}
+
+void HeaderTable::clear() {
+    for (auto &slice : slices) {
+        slice.offset = -1;
+        slice.size = 0;
+    }
+}
+
+void HeaderTable::set(HEADER_ID id, int32_t offset, int32_t size) {
+    slices[id].offset = offset;
+    slices[id].size = size;
+}
+
+void HeaderTable::shift(int32_t delta) {
+    for (auto &slice : slices) {
+        if (slice.offset >= 0)
+            slice.offset += delta;
+    }
+}
+
+// scanner implementations
+static const char *findAnyOf2Scalar(const char *p, const char *end, char a, char b) {
+    for (; p < end; ++p) {
+        if (*p == a || *p == b)
+            return p;
+    }
+    return end;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("sse2")))
+static const char *findAnyOf2Sse2(const char *p, const char *end, char a, char b) {
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    for (; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+    }
+    return findAnyOf2Scalar(p, end, a, b);
+}
+
+__attribute__((target("avx2")))
+static const char *findAnyOf2Avx2(const char *p, const char *end, char a, char b) {
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    for (; end - p >= 32; p += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb))));
+        if (mask != 0) {
+            _mm256_zeroupper();
+            return p + __builtin_ctz(mask);
+        }
+    }
+    // tail stays VEX encoded, calling legacy SSE code here costs a state transition
+    _mm256_zeroupper();
+    const __m128i sa = _mm_set1_epi8(a);
+    const __m128i sb = _mm_set1_epi8(b);
+    for (; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, sa), _mm_cmpeq_epi8(v, sb)));
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+    }
+    return findAnyOf2Scalar(p, end, a, b);
+}
+
+static bool cpuSupports(SCAN_LEVEL level) {
+    __builtin_cpu_init();
+    switch (level) {
+        case SCAN_AVX2:
+            return __builtin_cpu_supports("avx2");
+        case SCAN_SSE2:
+            return __builtin_cpu_supports("sse2");
+        default:
+            return true;
+    }
+}
+
+#else
+
+static bool cpuSupports(SCAN_LEVEL level) {
+    return level == SCAN_SCALAR;
+}
+
+#endif
+
+typedef const char *(*FindFunc)(const char *, const char *, char, char);
+
+static SCAN_LEVEL scan_level = SCAN_SCALAR;
+static FindFunc find_any_of_2 = findAnyOf2Scalar;
+
+bool setScanLevel(SCAN_LEVEL level) {
+    if (!cpuSupports(level))
+        return false;
+    switch (level) {
+#if defined(__x86_64__) || defined(__i386__)
+        case SCAN_AVX2:
+            find_any_of_2 = findAnyOf2Avx2;
+            break;
+        case SCAN_SSE2:
+            find_any_of_2 = findAnyOf2Sse2;
+            break;
+#endif
+        default:
+            find_any_of_2 = findAnyOf2Scalar;
+            break;
+    }
+    scan_level = level;
+    return true;
+}
+
+// pick best scanner before main()
+__attribute__((unused)) static bool scan_level_init = setScanLevel(SCAN_AVX2) || setScanLevel(SCAN_SSE2) || setScanLevel(SCAN_SCALAR);
+
+const char *findAnyOf2(const char *begin, const char *end, char a, char b) {
+    return find_any_of_2(begin, end, a, b);
+}
+
+SCAN_LEVEL scanLevel() {
+    return scan_level;
+}
+
+const char *scanLevelName(SCAN_LEVEL level) {
+    switch (level) {
+        case SCAN_AVX2:
+            return "avx2";
+        case SCAN_SSE2:
+            return "sse2";
+        default:
+            return "scalar";
+    }
+}
+
+/*
+ * dispatch on name length first, so at most two strncasecmp per header
+ */
+HEADER_ID matchHeaderName(const char *name, size_t size) {
+    switch (size) {
+        case 4:
+            return strncasecmp(name, "Host", 4) == 0 ? HDR_HOST : HDR_COUNT;
+        case 5:
+            return strncasecmp(name, "Range", 5) == 0 ? HDR_RANGE : HDR_COUNT;
+        case 6:
+            return strncasecmp(name, "Expect", 6) == 0 ? HDR_EXPECT : HDR_COUNT;
+        case 8:
+            return strncasecmp(name, "If-Range", 8) == 0 ? HDR_IF_RANGE : HDR_COUNT;
+        case 10:
+            if (strncasecmp(name, "Connection", 10) == 0)
+                return HDR_CONNECTION;
+            return strncasecmp(name, "User-Agent", 10) == 0 ? HDR_USER_AGENT : HDR_COUNT;
+        case 13:
+            return strncasecmp(name, "If-None-Match", 13) == 0 ? HDR_IF_NONE_MATCH : HDR_COUNT;
+        case 14:
+            return strncasecmp(name, "Content-Length", 14) == 0 ? HDR_CONTENT_LENGTH : HDR_COUNT;
+        case 15:
+            return strncasecmp(name, "Accept-Encoding", 15) == 0 ? HDR_ACCEPT_ENCODING : HDR_COUNT;
+        case 17:
+            if (strncasecmp(name, "Transfer-Encoding", 17) == 0)
+                return HDR_TRANSFER_ENCODING;
+            return strncasecmp(name, "If-Modified-Since", 17) == 0 ? HDR_IF_MODIFIED_SINCE : HDR_COUNT;
+        default:
+            return HDR_COUNT;
+    }
+}
+
+static bool zeroQuality(const char *param, const char *end) {
+    // ";q=0", ";q=0.0", ";q=0.000", spaces allowed around ';'
+    while (param < end && (*param == ' ' || *param == '\t' || *param == ';'))
+        ++param;
+    if (end - param < 3 || (param[0] != 'q' && param[0] != 'Q') || param[1] != '=')
+        return false;
+    param += 2;
+    if (*param != '0')
+        return false;
+    for (++param; param < end; ++param) {
+        if (*param != '.' && *param != '0' && *param != ' ' && *param != '\t')
+            return false;
+    }
+    return true;
+}
+
+unsigned parseAcceptEncoding(const char *value, size_t size) {
+    const char *end = value + size;
+    unsigned accepted = 0;
+    unsigned refused = 0;
+    bool any = false;
+    while (value < end) {
+        const char *comma = findAnyOf2(value, end, ',', ',');
+        const char *token = value;
+        while (token < comma && (*token == ' ' || *token == '\t'))
+            ++token;
+        const char *token_end = token;
+        while (token_end < comma && *token_end != ';' && *token_end != ' ' && *token_end != '\t')
+            ++token_end;
+        size_t token_size = token_end - token;
+        bool refuse = zeroQuality(token_end, comma);
+
+        unsigned bit = 0;
+        if ((token_size == 4 && strncasecmp(token, "gzip", 4) == 0) ||
+            (token_size == 6 && strncasecmp(token, "x-gzip", 6) == 0))
+            bit = 1u << ENC_GZIP;
+        else if (token_size == 2 && strncasecmp(token, "br", 2) == 0)
+            bit = 1u << ENC_BR;
+        else if (token_size == 1 && *token == '*')
+            any = !refuse;
+        if (refuse)
+            refused |= bit;
+        else
+            accepted |= bit;
+        value = comma + 1;
+    }
+    if (any)
+        accepted |= ((1u << ENC_COUNT) - 1) & ~refused;
+    return (accepted & ~refused) | 1u << ENC_IDENTITY;
+}
+
+bool matchETag(const char *value, size_t size, const char *etag, size_t etag_size) {
+    const char *end = value + size;
+    while (value < end) {
+        const char *comma = findAnyOf2(value, end, ',', ',');
+        const char *tag = value;
+        const char *tag_end = comma;
+        while (tag < tag_end && (*tag == ' ' || *tag == '\t'))
+            ++tag;
+        while (tag_end > tag && (*(tag_end - 1) == ' ' || *(tag_end - 1) == '\t'))
+            --tag_end;
+        if (tag_end - tag == 1 && *tag == '*')
+            return true;
+        if (tag_end - tag >= 2 && tag[0] == 'W' && tag[1] == '/')
+            tag += 2;
+        if (static_cast<size_t>(tag_end - tag) == etag_size && memcmp(tag, etag, etag_size) == 0)
+            return true;
+        value = comma + 1;
+    }
+    return false;
+}
+
+time_t parseHttpDate(const char *value, size_t size) {
+    // fixed layout, 29 bytes
+    char date[32];
+    if (size != 29)
+        return -1;
+    memcpy(date, value, size);
+    date[size] = '\0';
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (end == nullptr || *end != '\0')
+        return -1;
+    return timegm(&tm);
+}
+
+// digits of [begin, end) as value, -1 if empty, -2 if not a number
+static int64_t parseDigits(const char *begin, const char *end) {
+    if (begin == end)
+        return -1;
+    if (end - begin > 18)
+        return -2;
+    int64_t value = 0;
+    for (; begin < end; ++begin) {
+        if (*begin < '0' || *begin > '9')
+            return -2;
+        value = value * 10 + (*begin - '0');
+    }
+    return value;
+}
+
+RANGE_RESULT parseRange(const char *value, size_t size, int64_t length,
+                        ByteRange *ranges, int max_ranges, int &count) {
+    count = 0;
+    if (size < 6 || strncasecmp(value, "bytes=", 6) != 0)
+        return RANGE_IGNORE;
+    const char *end = value + size;
+    bool valid = false;
+    for (const char *p = value + 6; p < end;) {
+        const char *comma = findAnyOf2(p, end, ',', ',');
+        const char *spec = p;
+        const char *spec_end = comma;
+        p = comma + 1;
+        while (spec < spec_end && (*spec == ' ' || *spec == '\t'))
+            ++spec;
+        while (spec_end > spec && (*(spec_end - 1) == ' ' || *(spec_end - 1) == '\t'))
+            --spec_end;
+        if (spec == spec_end)
+            continue;
+        auto dash = static_cast<const char *>(memchr(spec, '-', spec_end - spec));
+        if (dash == nullptr)
+            return RANGE_IGNORE;
+        int64_t first = parseDigits(spec, dash);
+        int64_t last = parseDigits(dash + 1, spec_end);
+        if (first == -2 || last == -2 || (first == -1 && last == -1))
+            return RANGE_IGNORE;
+        if (first != -1 && last != -1 && last < first)
+            return RANGE_IGNORE;
+        valid = true;
+
+        if (first == -1) {
+            // suffix: last bytes of representation
+            if (last == 0 || length == 0)
+                continue;
+            first = last < length ? length - last : 0;
+            last = length - 1;
+        } else {
+            if (first >= length)
+                continue;
+            if (last == -1 || last >= length)
+                last = length - 1;
+        }
+        if (count == max_ranges)
+            return RANGE_IGNORE;
+        ranges[count].first = first;
+        ranges[count].last = last;
+        ++count;
+    }
+    if (!valid)
+        return RANGE_IGNORE;
+    if (count == 0)
+        return RANGE_UNSATISFIABLE;
+
+    // overlapping or adjacent ranges are coalesced (RFC 9110 14.2),
+    // so "0-,0-,0-" cannot make one request send the file many times
+    for (int i = 1; i < count; ++i) {
+        ByteRange range = ranges[i];
+        int j = i;
+        for (; j > 0 && ranges[j - 1].first > range.first; --j)
+            ranges[j] = ranges[j - 1];
+        ranges[j] = range;
+    }
+    int merged = 0;
+    for (int i = 1; i < count; ++i) {
+        if (ranges[i].first <= ranges[merged].last + 1) {
+            if (ranges[i].last > ranges[merged].last)
+                ranges[merged].last = ranges[i].last;
+        } else {
+            ranges[++merged] = ranges[i];
+        }
+    }
+    count = merged + 1;
+    return RANGE_OK;
+}
+
+int64_t parseContentLength(const char *value, size_t size) {
+    // 18 digits never overflow int64_t
+    if (size == 0 || size > 18)
+        return -1;
+    int64_t length = 0;
+    for (size_t i = 0; i < size; ++i) {
+        if (value[i] < '0' || value[i] > '9')
+            return -1;
+        length = length * 10 + (value[i] - '0');
+    }
+    return length;
+}
+
+void ChunkDecoder::reset() {
+    m_state = CHUNK_SIZE;
+    m_remaining = 0;
+    m_digits = 0;
+}
+
+// value of hex digit c, -1 if it is none
+static int hexDigit(char c) {
+    return c >= '0' && c <= '9' ? c - '0' :
+           (c | 0x20) >= 'a' && (c | 0x20) <= 'f' ? (c | 0x20) - 'a' + 10 : -1;
+}
+
+size_t ChunkDecoder::decode(char *data, size_t size, size_t &out_size) {
+    static const int max_digits = 15;   // chunk below 2^60
+    out_size = 0;
+    size_t i = 0;
+    while (i < size && m_state != CHUNK_DONE && m_state != CHUNK_BAD) {
+        char c = data[i];
+        switch (m_state) {
+            case CHUNK_SIZE: {
+                int digit = hexDigit(c);
+                if (digit >= 0 && m_digits < max_digits) {
+                    m_remaining = m_remaining * 16 + digit;
+                    ++m_digits;
+                } else if (m_digits == 0 || digit >= 0) {
+                    m_state = CHUNK_BAD;
+                } else if (c == ';' || c == ' ' || c == '\t') {
+                    m_state = CHUNK_EXT;
+                } else if (c == '\r') {
+                    m_state = CHUNK_SIZE_LF;
+                } else {
+                    m_state = CHUNK_BAD;
+                }
+                ++i;
+                break;
+            }
+            case CHUNK_EXT:
+                if (c == '\r')
+                    m_state = CHUNK_SIZE_LF;
+                ++i;
+                break;
+            case CHUNK_SIZE_LF:
+                m_state = c != '\n' ? CHUNK_BAD : m_remaining == 0 ? CHUNK_TRAILER : CHUNK_DATA;
+                ++i;
+                break;
+            case CHUNK_DATA: {
+                size_t n = size - i;
+                if (static_cast<int64_t>(n) > m_remaining)
+                    n = static_cast<size_t>(m_remaining);
+                memmove(data + out_size, data + i, n);
+                out_size += n;
+                i += n;
+                m_remaining -= static_cast<int64_t>(n);
+                if (m_remaining == 0)
+                    m_state = CHUNK_DATA_CR;
+                break;
+            }
+            case CHUNK_DATA_CR:
+                m_state = c == '\r' ? CHUNK_DATA_LF : CHUNK_BAD;
+                ++i;
+                break;
+            case CHUNK_DATA_LF:
+                m_state = c == '\n' ? CHUNK_SIZE : CHUNK_BAD;
+                m_digits = 0;
+                ++i;
+                break;
+            case CHUNK_TRAILER:
+                // start of a trailer line, empty one ends body
+                m_state = c == '\r' ? CHUNK_END_LF : CHUNK_TRAILER_LINE;
+                ++i;
+                break;
+            case CHUNK_TRAILER_LINE:
+                if (c == '\n')
+                    m_state = CHUNK_TRAILER;
+                ++i;
+                break;
+            case CHUNK_END_LF:
+                m_state = c == '\n' ? CHUNK_DONE : CHUNK_BAD;
+                ++i;
+                break;
+            default:
+                break;
+        }
+    }
+    return i;
+}
+
+PATH_RESULT normalizePath(const char *path, size_t size, const char *index_name, char *out, size_t out_size) {
+    const char *p = path;
+    const char *end = path + size;
+    size_t len = 0;
+    bool dir = true;    // path names a directory so far
+    while (p < end) {
+        if (*p == '/') {
+            ++p;
+            dir = true;
+            continue;
+        }
+        // one segment, decoded behind a separator
+        size_t mark = len;
+        if (len != 0) {
+            if (len + 1 >= out_size)
+                return PATH_BAD;
+            out[len++] = '/';
+        }
+        size_t segment = len;
+        while (p < end && *p != '/') {
+            char c = *p++;
+            if (c == '%') {
+                int high = end - p >= 2 ? hexDigit(p[0]) : -1;
+                int low = end - p >= 2 ? hexDigit(p[1]) : -1;
+                if (high < 0 || low < 0)
+                    return PATH_BAD;
+                c = static_cast<char>(high * 16 + low);
+                p += 2;
+                // an encoded separator would split a segment after checks
+                if (c == '\0' || c == '/')
+                    return PATH_BAD;
+            }
+            if (len + 1 >= out_size)
+                return PATH_BAD;
+            out[len++] = c;
+        }
+        size_t segment_size = len - segment;
+        dir = false;
+        if (segment_size == 1 && out[segment] == '.') {
+            len = mark;
+            dir = true;
+        } else if (segment_size == 2 && out[segment] == '.' && out[segment + 1] == '.') {
+            if (mark == 0)
+                return PATH_FORBIDDEN;
+            // drop segment before it with its separator
+            len = mark;
+            while (len > 0 && out[len - 1] != '/')
+                --len;
+            if (len > 0)
+                --len;
+            dir = true;
+        } else if (out[segment] == '.') {
+            return PATH_FORBIDDEN;
+        }
+    }
+    if (dir) {
+        size_t index_size = strlen(index_name);
+        if (len + 1 + index_size >= out_size)
+            return PATH_BAD;
+        if (len != 0)
+            out[len++] = '/';
+        memcpy(out + len, index_name, index_size);
+        len += index_size;
+    }
+    out[len] = '\0';
+    return PATH_OK;
+}
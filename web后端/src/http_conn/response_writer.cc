@@ -0,0 +1,347 @@
+#include <climits>
+#include <cstdio>
+#include <cstring>
+
+#include <unistd.h>
+#include <sys/sendfile.h>
+
+#include "response_writer.h"
+#include "file_cache.h"
+
+static Segment makeSegment(SEGMENT_KIND kind, size_t size) {
+    Segment seg;
+    seg.kind = kind;
+    seg.address = nullptr;
+    seg.offset = 0;
+    seg.size = size;
+    seg.sent = 0;
+    seg.fd = -1;
+    seg.own_fd = false;
+    return seg;
+}
+
+// slice of cached file: mapped bytes go by writev, an fd by sendfile()
+static Segment fileSegment(std::shared_ptr<const CachedFile> file, off_t offset, size_t size) {
+    Segment seg = makeSegment(SEG_MEMORY, size);
+    if (file->address != nullptr) {
+        seg.address = file->address + offset;
+    } else {
+        seg.kind = SEG_FILE;
+        seg.fd = file->fd;
+        seg.offset = offset;
+    }
+    seg.file = std::move(file);
+    return seg;
+}
+
+static void dropSegment(Segment &seg) {
+    if (seg.own_fd)
+        close(seg.fd);
+    seg.own_fd = false;
+}
+
+ResponseBody::~ResponseBody() {
+    clear();
+}
+
+void ResponseBody::append(std::string bytes) {
+    if (bytes.empty())
+        return;
+    Segment seg = makeSegment(SEG_OWNED, bytes.size());
+    seg.bytes = std::move(bytes);
+    m_size += seg.size;
+    m_segs.push_back(std::move(seg));
+}
+
+void ResponseBody::appendFile(std::shared_ptr<const CachedFile> file, off_t offset, size_t size) {
+    if (size == 0)
+        return;
+    m_size += size;
+    m_segs.push_back(fileSegment(std::move(file), offset, size));
+}
+
+void ResponseBody::appendFd(int fd, off_t offset, size_t size) {
+    if (size == 0) {
+        close(fd);
+        return;
+    }
+    Segment seg = makeSegment(SEG_FILE, size);
+    seg.fd = fd;
+    seg.own_fd = true;
+    seg.offset = offset;
+    m_size += size;
+    m_segs.push_back(std::move(seg));
+}
+
+void ResponseBody::stream(BodySource source) {
+    m_source = std::move(source);
+}
+
+void ResponseBody::clear() {
+    for (auto &seg : m_segs)
+        dropSegment(seg);
+    m_segs.clear();
+    m_size = 0;
+    m_source = nullptr;
+}
+
+ResponseWriter::~ResponseWriter() {
+    reset();
+}
+
+bool ResponseWriter::headerFits(size_t size) const {
+    return m_cursor + size <= BufferPool::maxSize();
+}
+
+/*
+ * bytes at append cursor, buffer grows by size class.
+ * past largest class the header is marked overflowed, endHeader() drops it
+ */
+void ResponseWriter::append(const char *bytes, size_t size) {
+    if (m_overflow)
+        return;
+    if (!m_header_buf.reserve(m_cursor + size)) {
+        m_overflow = true;
+        return;
+    }
+    memcpy(m_header_buf.data() + m_cursor, bytes, size);
+    m_cursor += size;
+}
+
+void ResponseWriter::beginHeader(const char *status_code, const char *reason) {
+    append("HTTP/1.1 ", 9);
+    append(status_code, strlen(status_code));
+    append(" ", 1);
+    append(reason, strlen(reason));
+    append("\r\n", 2);
+}
+
+void ResponseWriter::addHeader(const char *key, const char *value) {
+    append(key, strlen(key));
+    append(": ", 2);
+    append(value, strlen(value));
+    append("\r\n", 2);
+}
+
+void ResponseWriter::addHeader(const char *key, long long value) {
+    char number[24];
+    int size = snprintf(number, sizeof(number), "%lld", value);
+    append(key, strlen(key));
+    append(": ", 2);
+    append(number, static_cast<size_t>(size));
+    append("\r\n", 2);
+}
+
+void ResponseWriter::addLines(const std::string &lines) {
+    append(lines.data(), lines.size());
+}
+
+bool ResponseWriter::endHeader() {
+    append("\r\n", 2);
+    return closeHeader();
+}
+
+bool ResponseWriter::queueCopy(const char *bytes, size_t size) {
+    append(bytes, size);
+    return closeHeader();
+}
+
+/*
+ * header bytes since last segment become one, or extend a header
+ * segment right in front, so headers of pipelined small responses
+ * and multipart delimiters take a single iovec.
+ * an overflowed header is dropped.
+ */
+bool ResponseWriter::closeHeader() {
+    if (m_overflow) {
+        m_cursor = m_flushed;
+        m_overflow = false;
+        return false;
+    }
+    size_t size = m_cursor - m_flushed;
+    if (size == 0)
+        return true;
+    if (!m_segs.empty() && m_segs.back().kind == SEG_HEADER &&
+        static_cast<size_t>(m_segs.back().offset) + m_segs.back().size == m_flushed) {
+        m_segs.back().size += size;
+        m_queued += size;
+    } else {
+        Segment seg = makeSegment(SEG_HEADER, size);
+        seg.offset = static_cast<off_t>(m_flushed);
+        push(std::move(seg));
+    }
+    m_flushed = m_cursor;
+    return true;
+}
+
+void ResponseWriter::queueMemory(const char *address, size_t size, std::shared_ptr<const CachedFile> file) {
+    if (size == 0)
+        return;
+    Segment seg = makeSegment(SEG_MEMORY, size);
+    seg.address = address;
+    seg.file = std::move(file);
+    push(std::move(seg));
+}
+
+void ResponseWriter::queueFile(std::shared_ptr<const CachedFile> file, off_t offset, size_t size) {
+    if (size == 0)
+        return;
+    push(fileSegment(std::move(file), offset, size));
+}
+
+/*
+ * take segments of a generated body, behind its header.
+ * chunked: appended segments are framed as first chunk,
+ * the source is pulled and framed by pending()
+ */
+void ResponseWriter::queueBody(ResponseBody &body, bool chunked) {
+    m_chunked = chunked && body.streamed();
+    m_chunk_open = false;
+    if (m_chunked && body.m_size != 0) {
+        char line[24];
+        snprintf(line, sizeof(line), "%zx\r\n", body.m_size);
+        pushOwned(line);
+        m_chunk_open = true;
+    }
+    for (auto &seg : body.m_segs)
+        push(std::move(seg));
+    body.m_segs.clear();
+    body.m_size = 0;
+    m_source = std::move(body.m_source);
+    body.m_source = nullptr;
+}
+
+ResponseWriter::Mark ResponseWriter::mark() const {
+    return Mark{m_segs.size(), m_segs.empty() ? 0 : m_segs.back().size, m_cursor, m_queued};
+}
+
+void ResponseWriter::rollback(const Mark &mark) {
+    while (m_segs.size() > mark.segs) {
+        dropSegment(m_segs.back());
+        m_segs.pop_back();
+    }
+    if (!m_segs.empty())
+        m_segs.back().size = mark.tail_size;
+    m_cursor = m_flushed = mark.cursor;
+    m_overflow = false;
+    m_queued = mark.queued;
+}
+
+void ResponseWriter::push(Segment &&seg) {
+    m_queued += seg.size;
+    m_segs.push_back(std::move(seg));
+}
+
+void ResponseWriter::pushOwned(std::string bytes) {
+    Segment seg = makeSegment(SEG_OWNED, bytes.size());
+    seg.bytes = std::move(bytes);
+    push(std::move(seg));
+}
+
+void ResponseWriter::popFront() {
+    dropSegment(m_segs.front());
+    m_segs.pop_front();
+}
+
+/*
+ * pull stream until a window is queued, it ends or has nothing now,
+ * each non empty piece framed as a chunk. after an empty piece the
+ * conn polls for write and pulls again, see stalled()
+ */
+void ResponseWriter::pull() {
+    while (m_source && m_queued < stream_window) {
+        std::string chunk;
+        bool more = m_source(chunk);
+        if (chunk.empty() && more)
+            return;
+        if (!chunk.empty()) {
+            if (m_chunked) {
+                char line[24];
+                snprintf(line, sizeof(line), "%s%zx\r\n", m_chunk_open ? "\r\n" : "", chunk.size());
+                pushOwned(line);
+                m_chunk_open = true;
+            }
+            pushOwned(std::move(chunk));
+        }
+        if (!more) {
+            m_source = nullptr;
+            if (m_chunked)
+                pushOwned(m_chunk_open ? "\r\n0\r\n\r\n" : "0\r\n\r\n");
+        }
+    }
+}
+
+bool ResponseWriter::pending() {
+    if (m_source && m_queued < stream_window)
+        pull();
+    return !m_segs.empty();
+}
+
+bool ResponseWriter::fileNext() const {
+    return !m_segs.empty() && m_segs.front().kind == SEG_FILE;
+}
+
+/*
+ * fill iovec with unsent segments up to IOV_MAX, stop at a sendfile()
+ * segment. more is set if bytes are left after them.
+ * return count of iovec
+ */
+int ResponseWriter::buildVec(bool &more) {
+    size_t limit = m_segs.size() < IOV_MAX ? m_segs.size() : IOV_MAX;
+    if (m_vec.size() < limit)
+        m_vec.resize(limit);
+    size_t count = 0;
+    for (; count < limit; ++count) {
+        const Segment &seg = m_segs[count];
+        const char *base;
+        if (seg.kind == SEG_FILE)
+            break;
+        if (seg.kind == SEG_HEADER)
+            base = m_header_buf.data() + seg.offset;
+        else if (seg.kind == SEG_MEMORY)
+            base = seg.address;
+        else
+            base = seg.bytes.data();
+        m_vec[count].iov_base = const_cast<char *>(base) + seg.sent;
+        m_vec[count].iov_len = seg.size - seg.sent;
+    }
+    more = count < m_segs.size() || m_source;
+    return static_cast<int>(count);
+}
+
+// front segment by sendfile(), from where last step stopped
+ssize_t ResponseWriter::sendFile(int sock_fd) {
+    const Segment &seg = m_segs.front();
+    off_t offset = seg.offset + static_cast<off_t>(seg.sent);
+    return sendfile(sock_fd, seg.fd, &offset, seg.size - seg.sent);
+}
+
+// move sent bytes forward through queue, drop finished segments
+void ResponseWriter::consume(size_t bytes) {
+    m_queued -= bytes;
+    while (bytes > 0 && !m_segs.empty()) {
+        Segment &seg = m_segs.front();
+        size_t left = seg.size - seg.sent;
+        if (bytes < left) {
+            seg.sent += bytes;
+            return;
+        }
+        bytes -= left;
+        popFront();
+    }
+}
+
+void ResponseWriter::reset() {
+    while (!m_segs.empty())
+        popFront();
+    m_queued = 0;
+    m_source = nullptr;
+    m_chunked = false;
+    m_chunk_open = false;
+    m_header_buf.release();
+    m_cursor = 0;
+    m_flushed = 0;
+    m_overflow = false;
+    if (m_vec.size() > 64)
+        std::vector<struct iovec>().swap(m_vec);
+}
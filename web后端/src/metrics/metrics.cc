@@ -0,0 +1,189 @@
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "metrics.h"
+
+static const char *counter_names[CNT_COUNT] = {
+        "accept", "accept_drop", "close", "read_bytes", "write_bytes", "requests", "task_reject", "log_drop", "syscalls",
+        "stale_events", "inline_runs", "offload_runs"
+};
+static const char *histogram_names[HIST_COUNT] = {
+        "queue_wait", "parse", "write"
+};
+static const char *gauge_names[GAUGE_COUNT] = {
+        "inline_cost_ns", "inline_limit_ns"
+};
+
+static const uint64_t start_ns = Metrics::nowNs();
+
+// slots of every thread ever recorded, only locked on attach and render
+static std::mutex registry_mutex;
+static std::vector<ThreadMetrics *> registry;
+
+ThreadMetrics *Metrics::attach() {
+    void *memory = nullptr;
+    if (posix_memalign(&memory, alignof(ThreadMetrics), sizeof(ThreadMetrics)) != 0)
+        throw std::bad_alloc();
+    auto metrics = new(memory) ThreadMetrics();
+    std::lock_guard<std::mutex> g(registry_mutex);
+    registry.push_back(metrics);
+    return metrics;
+}
+
+namespace {
+
+// sum of all thread slots at one moment
+struct Snapshot {
+    uint64_t counters[CNT_COUNT] = {};
+    uint64_t buckets[HIST_COUNT][ThreadMetrics::bucket_num] = {};
+    uint64_t sums[HIST_COUNT] = {};
+    uint64_t counts[HIST_COUNT] = {};
+    uint64_t status[ThreadMetrics::max_status - ThreadMetrics::min_status] = {};
+    uint64_t gauges[GAUGE_COUNT] = {};
+    size_t thread_num = 0;
+
+    Snapshot() {
+        std::lock_guard<std::mutex> g(registry_mutex);
+        thread_num = registry.size();
+        for (ThreadMetrics *metrics : registry) {
+            for (int i = 0; i < CNT_COUNT; ++i)
+                counters[i] += metrics->counters[i].load(std::memory_order_relaxed);
+            for (int i = 0; i < HIST_COUNT; ++i) {
+                for (int j = 0; j < ThreadMetrics::bucket_num; ++j) {
+                    uint64_t n = metrics->histograms[i].buckets[j].load(std::memory_order_relaxed);
+                    buckets[i][j] += n;
+                    counts[i] += n;
+                }
+                sums[i] += metrics->histograms[i].sum.load(std::memory_order_relaxed);
+            }
+            for (int i = 0; i < ThreadMetrics::max_status - ThreadMetrics::min_status; ++i)
+                status[i] += metrics->status[i].load(std::memory_order_relaxed);
+            for (int i = 0; i < GAUGE_COUNT; ++i) {
+                uint64_t value = metrics->gauges[i].load(std::memory_order_relaxed);
+                if (value > gauges[i])
+                    gauges[i] = value;
+            }
+        }
+    }
+
+    // interpolated inside the power of 2 bucket holding the rank
+    uint64_t percentile(int histogram, double p) const {
+        uint64_t rank = static_cast<uint64_t>(counts[histogram] * p);
+        uint64_t seen = 0;
+        for (int i = 0; i < ThreadMetrics::bucket_num; ++i) {
+            uint64_t n = buckets[histogram][i];
+            if (seen + n > rank) {
+                uint64_t low = i == 0 ? 0 : 1ULL << i;
+                uint64_t width = i == 0 ? 2 : 1ULL << i;
+                return low + static_cast<uint64_t>(width * (static_cast<double>(rank - seen) / n));
+            }
+            seen += n;
+        }
+        return 0;
+    }
+};
+
+void appendFormat(std::string &out, const char *format, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int size = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (size > 0)
+        out.append(buf, static_cast<size_t>(size) < sizeof(buf) ? size : sizeof(buf) - 1);
+}
+
+}
+
+std::string Metrics::renderJson() {
+    Snapshot snapshot;
+    std::string out;
+    appendFormat(out, "{\"uptime_seconds\":%.3f,\"threads\":%zu,\"active_conns\":%lld",
+                 (nowNs() - start_ns) / 1e9, snapshot.thread_num,
+                 static_cast<long long>(snapshot.counters[CNT_ACCEPT] - snapshot.counters[CNT_CLOSE]));
+    for (int i = 0; i < CNT_COUNT; ++i)
+        appendFormat(out, ",\"%s\":%llu", counter_names[i],
+                     static_cast<unsigned long long>(snapshot.counters[i]));
+    for (int i = 0; i < GAUGE_COUNT; ++i)
+        appendFormat(out, ",\"%s\":%llu", gauge_names[i],
+                     static_cast<unsigned long long>(snapshot.gauges[i]));
+
+    out += ",\"status\":{";
+    bool first = true;
+    for (int i = 0; i < ThreadMetrics::max_status - ThreadMetrics::min_status; ++i) {
+        if (snapshot.status[i] == 0)
+            continue;
+        appendFormat(out, "%s\"%d\":%llu", first ? "" : ",", i + ThreadMetrics::min_status,
+                     static_cast<unsigned long long>(snapshot.status[i]));
+        first = false;
+    }
+
+    out += "},\"latency_ns\":{";
+    for (int i = 0; i < HIST_COUNT; ++i) {
+        uint64_t count = snapshot.counts[i];
+        appendFormat(out, "%s\"%s\":{\"count\":%llu,\"mean\":%llu,\"p50\":%llu,\"p99\":%llu,\"p999\":%llu}",
+                     i == 0 ? "" : ",", histogram_names[i],
+                     static_cast<unsigned long long>(count),
+                     static_cast<unsigned long long>(count == 0 ? 0 : snapshot.sums[i] / count),
+                     static_cast<unsigned long long>(snapshot.percentile(i, 0.5)),
+                     static_cast<unsigned long long>(snapshot.percentile(i, 0.99)),
+                     static_cast<unsigned long long>(snapshot.percentile(i, 0.999)));
+    }
+    out += "}}\n";
+    return out;
+}
+
+/*
+ * prometheus text format 0.0.4,
+ * histogram buckets stop at the highest non empty one
+ */
+std::string Metrics::renderPrometheus() {
+    Snapshot snapshot;
+    std::string out;
+    appendFormat(out, "# TYPE tinyserver_uptime_seconds gauge\ntinyserver_uptime_seconds %.3f\n",
+                 (nowNs() - start_ns) / 1e9);
+    appendFormat(out, "# TYPE tinyserver_active_conns gauge\ntinyserver_active_conns %lld\n",
+                 static_cast<long long>(snapshot.counters[CNT_ACCEPT] - snapshot.counters[CNT_CLOSE]));
+    for (int i = 0; i < CNT_COUNT; ++i)
+        appendFormat(out, "# TYPE tinyserver_%s_total counter\ntinyserver_%s_total %llu\n",
+                     counter_names[i], counter_names[i],
+                     static_cast<unsigned long long>(snapshot.counters[i]));
+    for (int i = 0; i < GAUGE_COUNT; ++i)
+        appendFormat(out, "# TYPE tinyserver_%s gauge\ntinyserver_%s %llu\n",
+                     gauge_names[i], gauge_names[i],
+                     static_cast<unsigned long long>(snapshot.gauges[i]));
+
+    out += "# TYPE tinyserver_responses_total counter\n";
+    for (int i = 0; i < ThreadMetrics::max_status - ThreadMetrics::min_status; ++i) {
+        if (snapshot.status[i] != 0)
+            appendFormat(out, "tinyserver_responses_total{code=\"%d\"} %llu\n",
+                         i + ThreadMetrics::min_status, static_cast<unsigned long long>(snapshot.status[i]));
+    }
+
+    for (int i = 0; i < HIST_COUNT; ++i) {
+        const char *name = histogram_names[i];
+        appendFormat(out, "# TYPE tinyserver_%s_seconds histogram\n", name);
+        int last = -1;
+        for (int j = 0; j < ThreadMetrics::bucket_num; ++j) {
+            if (snapshot.buckets[i][j] != 0)
+                last = j;
+        }
+        uint64_t cumulative = 0;
+        for (int j = 0; j <= last; ++j) {
+            cumulative += snapshot.buckets[i][j];
+            appendFormat(out, "tinyserver_%s_seconds_bucket{le=\"%.9g\"} %llu\n", name,
+                         std::ldexp(1.0, j + 1) / 1e9, static_cast<unsigned long long>(cumulative));
+        }
+        appendFormat(out, "tinyserver_%s_seconds_bucket{le=\"+Inf\"} %llu\n", name,
+                     static_cast<unsigned long long>(snapshot.counts[i]));
+        appendFormat(out, "tinyserver_%s_seconds_sum %.9f\n", name, snapshot.sums[i] / 1e9);
+        appendFormat(out, "tinyserver_%s_seconds_count %llu\n", name,
+                     static_cast<unsigned long long>(snapshot.counts[i]));
+    }
+    return out;
+}
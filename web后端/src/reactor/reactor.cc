@@ -0,0 +1,344 @@
+#include <stdexcept>
+
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "reactor.h"
+#include "common.h"
+#include "http_conn.h"
+#include "metrics.h"
+#include "threadpool.h"
+
+constexpr int max_epoll_events = 1024;
+
+// epoll data of non conn fds, out of ConnTable id range
+constexpr uint64_t listen_data = UINT64_MAX;
+constexpr uint64_t event_data = UINT64_MAX - 1;
+
+// reactor running on this thread, nullptr on ThreadPool workers
+static thread_local Reactor *t_reactor = nullptr;
+
+Reactor::Reactor(int id, const ServerConfig &config, ThreadPool &thread_pool)
+        : m_id(id), m_config(config), m_thread_pool(thread_pool),
+          m_thread(0), m_accept_pending(false), m_inline_cost_ns(0), m_inline_probe(0),
+          m_pending_ev(0), m_handback(nullptr), m_stop(false) {
+    m_idle_ticks = (config.idle_timeout + config.tick_interval - 1) / config.tick_interval;
+    m_inline_limit_ns = static_cast<uint64_t>(config.inline_limit) * 1000;
+
+    m_listen_fd = createListenFd(config.port, config.backlog, config.defer_accept, config.nodelay);
+    m_epoll_fd = epoll_create(5);
+    if (m_epoll_fd == -1) {
+        close(m_listen_fd);
+        printf("%s\n", strerror(errno));
+        throw std::runtime_error("create epoll error");
+    }
+    m_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_event_fd == -1) {
+        close(m_listen_fd);
+        close(m_epoll_fd);
+        printf("%s\n", strerror(errno));
+        throw std::runtime_error("create eventfd error");
+    }
+    addToEpoll(m_epoll_fd, m_listen_fd, listen_data);
+    addToEpoll(m_epoll_fd, m_event_fd, event_data);
+    m_reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    pthread_mutex_init(&m_wakeup_mutex, nullptr);
+}
+
+Reactor::~Reactor() {
+    // ThreadPool is stopped by now, conns it handed back after loop ended
+    // are taken here, before m_conns they point into goes away
+    takeBack();
+    if (m_reserve_fd != -1)
+        close(m_reserve_fd);
+    close(m_event_fd);
+    close(m_epoll_fd);
+    close(m_listen_fd);
+    pthread_mutex_destroy(&m_wakeup_mutex);
+}
+
+void Reactor::start() {
+    int err = pthread_create(&m_thread, nullptr, worker, this);
+    if (err != 0)
+        throw std::runtime_error("In class Reactor: create thread error");
+
+    pinThread(m_thread, m_id);
+}
+
+void Reactor::join() {
+    if (m_thread != 0)
+        pthread_join(m_thread, nullptr);
+    m_thread = 0;
+}
+
+/*
+ * called by other thread or signal handler path,
+ * only touch atomic and eventfd here.
+ */
+void Reactor::notify(uint64_t ev) {
+    m_pending_ev.fetch_or(ev);
+    uint64_t one = 1;
+    write(m_event_fd, &one, sizeof(one));
+}
+
+void *Reactor::worker(void *arg) {
+    auto reactor = static_cast<Reactor *>(arg);
+    reactor->loop();
+    return reactor;
+}
+
+void Reactor::loop() {
+    struct epoll_event events[max_epoll_events];
+    Metrics::set(GAUGE_INLINE_LIMIT, m_inline_limit_ns);
+    t_reactor = this;
+
+    //循环监听事件
+    while (!m_stop) {
+        Metrics::add(CNT_SYSCALL);
+        // conns left in backlog by accept budget, only poll
+        int n = epoll_wait(m_epoll_fd, events, max_epoll_events, m_accept_pending ? 0 : -1);
+        if (n == -1 && errno != EINTR) {
+            break;
+        }
+
+        //处理链接
+        for (int i = 0; i < n; ++i) {
+            uint64_t data = events[i].data.u64;    //取出conn id
+            uint32_t event = events[i].events; //取出事件
+            if (data == listen_data) {
+                // accepted after established conns of this batch
+                m_accept_pending = true;
+                continue;
+            } else if (data == event_data) {
+                handleNotify();
+                continue;
+            }
+            HttpConn *conn = m_conns.find(data);
+            if (conn == nullptr) {
+                // conn closed earlier in this batch, slot may be reused
+                Metrics::add(CNT_STALE_EVENT);
+                continue;
+            }
+            if (event & EPOLLIN) {
+                // handle EPOLLIN event on conn fd,
+                // which is usually http request
+                if (conn->readReqToBuf()) {
+                    // if success, handle users request and prepare write
+                    m_timer_wheel.refresh(conn, m_idle_ticks);
+                    // a spliced body needs no parsing until it is complete
+                    if (conn->splicing())
+                        waitRead(conn);
+                    else
+                        dispatch(conn);
+                } else {
+                    closeUser(conn);
+                }
+            } else if (event & EPOLLOUT) {
+                // handle EPOLLOUT event on conn fd,
+                // which is usually writing http request to client.
+                // refreshed first, requests read ahead may go to ThreadPool
+                m_timer_wheel.refresh(conn, m_idle_ticks);
+                if (!conn->writeResp())
+                    closeUser(conn);
+            } else {
+                // handle error or unsupported event
+                closeUser(conn);
+            }
+        }
+        if (m_accept_pending)
+            handleAccept();
+    }
+}
+
+/*
+ * accept at most accept_budget conns, so a connection storm
+ * can not starve established ones. listen fd is edge triggered,
+ * m_accept_pending keeps the rest for next loop iteration.
+ */
+void Reactor::handleAccept() {
+    // handle new request
+    struct sockaddr_in conn_address;
+    m_accept_pending = false;
+    for (int i = 0; i < m_config.accept_budget; ++i) {
+        socklen_t conn_size = sizeof(conn_address);
+        Metrics::add(CNT_SYSCALL);
+        int conn_fd = accept4(m_listen_fd, reinterpret_cast<struct sockaddr *>(&conn_address), &conn_size,
+                              SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (conn_fd == -1) {
+            // conn reset while queued, try next one
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if ((errno == EMFILE || errno == ENFILE) && shedAccept())
+                continue;
+            // backlog empty, else accept again on next loop iteration,
+            // listen fd is edge triggered and may not report it again
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                m_accept_pending = true;
+            return;
+        }
+        Metrics::add(CNT_ACCEPT);
+        uint64_t conn_id;
+        HttpConn *conn = m_conns.acquire(conn_id);
+        conn->init(conn_fd, conn_address, this, conn_id);
+        Metrics::add(CNT_SYSCALL);
+        addToEpoll(m_epoll_fd, conn_fd, conn_id, true);
+        m_timer_wheel.add(conn, m_idle_ticks);
+    }
+    m_accept_pending = true;
+}
+
+/*
+ * out of fds: free reserve fd to accept one conn and close it at once,
+ * so a client is refused instead of waiting in backlog.
+ * false if reserve fd is gone too.
+ */
+bool Reactor::shedAccept() {
+    if (m_reserve_fd == -1)
+        return false;
+    close(m_reserve_fd);
+    Metrics::add(CNT_SYSCALL);
+    int conn_fd = accept4(m_listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (conn_fd != -1) {
+        Metrics::add(CNT_ACCEPT_DROP);
+        close(conn_fd);
+    }
+    m_reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    return conn_fd != -1;
+}
+
+/*
+ * run cheap requests inline, saving a ThreadPool handoff and
+ * moving conn to another core. the moving average of inline run
+ * time adapts: above inline_limit only one in probe_interval cheap
+ * runs stays inline to measure, the rest go to ThreadPool.
+ */
+void Reactor::dispatch(HttpConn *conn) {
+    if (m_inline_limit_ns != 0 && conn->cheapRequest() &&
+        (m_inline_cost_ns <= m_inline_limit_ns || ++m_inline_probe % probe_interval == 0)) {
+        uint64_t begin = Metrics::nowNs();
+        conn->run();
+        uint64_t cost = Metrics::nowNs() - begin;
+        // ewma with weight 1/8
+        m_inline_cost_ns = m_inline_cost_ns - m_inline_cost_ns / 8 + cost / 8;
+        Metrics::add(CNT_INLINE_RUN);
+        Metrics::set(GAUGE_INLINE_COST, m_inline_cost_ns);
+        return;
+    }
+    Metrics::add(CNT_OFFLOAD_RUN);
+    conn->offloaded = true;
+    if (!m_thread_pool.appendTask(conn)) {
+        // overloaded, shed conn with a canned 503
+        conn->offloaded = false;
+        conn->rejectOverload();
+        closeUser(conn);
+    }
+}
+
+void Reactor::handleNotify() {
+    uint64_t count;
+    while (read(m_event_fd, &count, sizeof(count)) > 0) {}
+
+    uint64_t ev = m_pending_ev.exchange(0);
+    // a push after this exchange notifies again
+    takeBack();
+    if (ev & EV_WAKE)
+        resumeStreams();
+    if (ev & EV_TICK)
+        m_timer_wheel.tick();
+    if (ev & EV_STOP)
+        m_stop = true;
+}
+
+void Reactor::closeUser(HttpConn *conn) {
+    m_timer_wheel.remove(conn);
+    Metrics::add(CNT_SYSCALL);
+    removeFromEpoll(m_epoll_fd, conn->fd());
+    m_conns.release(conn->connId());
+    conn->closeConn();
+}
+
+void Reactor::wakeStream(uint64_t conn_id) {
+    pthread_mutex_lock(&m_wakeup_mutex);
+    m_wakeups.push_back(conn_id);
+    pthread_mutex_unlock(&m_wakeup_mutex);
+    notify(EV_WAKE);
+}
+
+/*
+ * a stalled conn is armed for nothing, so only its waker brings it
+ * back. a conn closed since, or one already waiting for EPOLLOUT
+ * or run by a worker, is skipped.
+ */
+void Reactor::resumeStreams() {
+    std::vector<uint64_t> wakeups;
+    pthread_mutex_lock(&m_wakeup_mutex);
+    wakeups.swap(m_wakeups);
+    pthread_mutex_unlock(&m_wakeup_mutex);
+    for (uint64_t conn_id : wakeups) {
+        HttpConn *conn = m_conns.find(conn_id);
+        if (conn == nullptr || conn->offloaded || !conn->writeStalled())
+            continue;
+        m_timer_wheel.refresh(conn, m_idle_ticks);
+        if (!conn->writeResp())
+            closeUser(conn);
+    }
+}
+
+void Reactor::waitRead(HttpConn *conn) {
+    rearm(conn, EPOLLIN);
+}
+
+void Reactor::waitWrite(HttpConn *conn) {
+    rearm(conn, EPOLLOUT);
+}
+
+/*
+ * on a worker this is its last touch of conn: after the push
+ * the loop may re-arm, serve and close it any time
+ */
+void Reactor::rearm(HttpConn *conn, uint32_t ev) {
+    if (t_reactor == this) {
+        Metrics::add(CNT_SYSCALL);
+        modFd(m_epoll_fd, conn->fd(), conn->connId(), static_cast<int>(ev | EPOLLONESHOT));
+        return;
+    }
+    conn->offload_ev = ev;
+    OffloadNode *head = m_handback.load(std::memory_order_relaxed);
+    do {
+        conn->offload_next = head;
+    } while (!m_handback.compare_exchange_weak(head, conn, std::memory_order_release,
+                                               std::memory_order_relaxed));
+    // loop is woken once per batch, it takes the whole stack
+    if (head == nullptr)
+        notify(EV_HANDBACK);
+}
+
+void Reactor::takeBack() {
+    OffloadNode *node = m_handback.exchange(nullptr, std::memory_order_acquire);
+    while (node != nullptr) {
+        auto conn = static_cast<HttpConn *>(node);
+        node = node->offload_next;
+        conn->offloaded = false;
+        Metrics::add(CNT_SYSCALL);
+        modFd(m_epoll_fd, conn->fd(), conn->connId(), static_cast<int>(conn->offload_ev | EPOLLONESHOT));
+    }
+}
+
+/*
+ * timer expiry of a conn a worker owns waits for next round,
+ * it is busy, not idle
+ */
+void Reactor::dropConn(HttpConn *conn) {
+    if (conn->offloaded) {
+        m_timer_wheel.add(conn, m_idle_ticks);
+        return;
+    }
+    closeUser(conn);
+}
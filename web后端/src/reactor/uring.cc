@@ -0,0 +1,180 @@
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "metrics.h"
+#include "uring.h"
+
+static int uringSetup(unsigned entries, struct io_uring_params *params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int uringEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    Metrics::add(CNT_SYSCALL);
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+static int uringRegister(int fd, unsigned opcode, const void *arg, unsigned nr_args) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+Uring::Uring(unsigned entries)
+        : m_ring_fd(-1), m_ring_ptr(MAP_FAILED), m_ring_size(0), m_sqes(nullptr), m_sqes_size(0),
+          m_sqe_head(0), m_sqe_tail(0),
+          m_buf_ring(nullptr), m_buf_ring_size(0), m_buf_mask(0), m_buf_tail(0), m_buf_group(0),
+          m_bufs(nullptr), m_buf_num(0), m_buf_size(0) {
+    // newest flags first: completions only run when this thread waits on ring
+    const unsigned flag_sets[] = {
+            IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN,
+            IORING_SETUP_COOP_TASKRUN,
+            0
+    };
+    struct io_uring_params params;
+    for (unsigned flags : flag_sets) {
+        memset(&params, 0, sizeof(params));
+        params.flags = flags | IORING_SETUP_CQSIZE;
+        params.cq_entries = entries * 4;
+        m_ring_fd = uringSetup(entries, &params);
+        if (m_ring_fd != -1 || errno != EINVAL)
+            break;
+    }
+    if (m_ring_fd == -1) {
+        printf("%s\n", strerror(errno));
+        throw std::runtime_error("io_uring setup error");
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        close(m_ring_fd);
+        throw std::runtime_error("io_uring too old, no single mmap");
+    }
+
+    // sq and cq rings share one mapping
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    m_ring_size = sq_size > cq_size ? sq_size : cq_size;
+    m_ring_ptr = mmap(nullptr, m_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      m_ring_fd, IORING_OFF_SQ_RING);
+    if (m_ring_ptr == MAP_FAILED) {
+        close(m_ring_fd);
+        throw std::runtime_error("io_uring mmap error");
+    }
+
+    m_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      m_ring_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        munmap(m_ring_ptr, m_ring_size);
+        close(m_ring_fd);
+        throw std::runtime_error("io_uring mmap error");
+    }
+    m_sqes = static_cast<struct io_uring_sqe *>(sqes);
+
+    char *sq = static_cast<char *>(m_ring_ptr);
+    m_sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    m_sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    m_sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    m_sq_entries = params.sq_entries;
+    m_sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    // sqe i always sits in slot i, array never changes again
+    for (unsigned i = 0; i < m_sq_entries; ++i)
+        m_sq_array[i] = i;
+    m_sqe_head = m_sqe_tail = *m_sq_tail;
+
+    char *cq = static_cast<char *>(m_ring_ptr);
+    m_cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    m_cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    m_cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+}
+
+Uring::~Uring() {
+    if (m_bufs != nullptr)
+        munmap(m_bufs, static_cast<size_t>(m_buf_num) * m_buf_size);
+    if (m_buf_ring != nullptr)
+        munmap(m_buf_ring, m_buf_ring_size);
+    munmap(m_sqes, m_sqes_size);
+    munmap(m_ring_ptr, m_ring_size);
+    close(m_ring_fd);
+}
+
+struct io_uring_sqe *Uring::getSqe() {
+    unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    if (m_sqe_tail - head >= m_sq_entries) {
+        submitAndWait(0);
+        head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+        if (m_sqe_tail - head >= m_sq_entries)
+            return nullptr;
+    }
+    struct io_uring_sqe *sqe = &m_sqes[m_sqe_tail & m_sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ++m_sqe_tail;
+    return sqe;
+}
+
+int Uring::submitAndWait(unsigned wait_num) {
+    unsigned to_submit = m_sqe_tail - m_sqe_head;
+    __atomic_store_n(m_sq_tail, m_sqe_tail, __ATOMIC_RELEASE);
+    unsigned flags = wait_num > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int ret = uringEnter(m_ring_fd, to_submit, wait_num, flags);
+    if (ret > 0)
+        m_sqe_head += static_cast<unsigned>(ret);
+    return ret;
+}
+
+bool Uring::registerSparseFiles(unsigned num) {
+    struct io_uring_rsrc_register reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.nr = num;
+    reg.flags = IORING_RSRC_REGISTER_SPARSE;
+    return uringRegister(m_ring_fd, IORING_REGISTER_FILES2, &reg, sizeof(reg)) == 0;
+}
+
+/*
+ * buffers go to kernel through a mapped ring (linux 5.19+,
+ * same as multishot accept the engine needs anyway)
+ */
+bool Uring::setupBufRing(uint16_t group, unsigned num, unsigned size) {
+    void *bufs = mmap(nullptr, static_cast<size_t>(num) * size, PROT_READ | PROT_WRITE,
+                      MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (bufs == MAP_FAILED)
+        return false;
+    m_bufs = static_cast<char *>(bufs);
+    m_buf_num = num;
+    m_buf_size = size;
+    m_buf_mask = num - 1;
+    m_buf_group = group;
+
+    m_buf_ring_size = num * sizeof(struct io_uring_buf);
+    void *ring = mmap(nullptr, m_buf_ring_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (ring == MAP_FAILED)
+        return false;
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+    reg.ring_entries = num;
+    reg.bgid = group;
+    if (uringRegister(m_ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        munmap(ring, m_buf_ring_size);
+        return false;
+    }
+    m_buf_ring = static_cast<struct io_uring_buf_ring *>(ring);
+    for (unsigned i = 0; i < num; ++i)
+        recycleBuffer(static_cast<uint16_t>(i));
+    return true;
+}
+
+void Uring::recycleBuffer(uint16_t bid) {
+    // entry i is at ring + i * 16, its tail overlays resv of entry 0.
+    // bufs[] of the uapi header is a flex array in a union, which
+    // compiles to offset 8 in C++, so it is not used
+    struct io_uring_buf &buf = reinterpret_cast<struct io_uring_buf *>(m_buf_ring)[m_buf_tail & m_buf_mask];
+    buf.addr = reinterpret_cast<uint64_t>(buffer(bid));
+    buf.len = m_buf_size;
+    buf.bid = bid;
+    ++m_buf_tail;
+    __atomic_store_n(&m_buf_ring->tail, m_buf_tail, __ATOMIC_RELEASE);
+}
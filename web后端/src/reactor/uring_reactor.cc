@@ -0,0 +1,509 @@
+#include <stdexcept>
+
+#include <cstring>
+#include <cerrno>
+
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+#include "uring_reactor.h"
+#include "access_log.h"
+#include "common.h"
+#include "metrics.h"
+#include "uring.h"
+
+constexpr unsigned ring_entries = 1024;
+constexpr uint16_t buf_group = 0;
+constexpr unsigned buf_num = 1024;      // power of 2
+constexpr unsigned buf_size = 4096;
+
+static const int no_file = -1;          // FILES_UPDATE argument clearing a slot
+constexpr unsigned max_files = 1u << 20;    // kernel limit of fixed file table
+
+UringReactor::UringReactor(int id, const ServerConfig &config)
+        : m_id(id), m_config(config), m_event_value(0), m_thread(0),
+          m_accept_count(0), m_accept_armed(false), m_accept_cancel(false),
+          m_files(0), m_pending_ev(0), m_stop(false) {
+    m_idle_ticks = (config.idle_timeout + config.tick_interval - 1) / config.tick_interval;
+
+    m_listen_fd = createListenFd(config.port, config.backlog, config.defer_accept, config.nodelay);
+    m_event_fd = eventfd(0, EFD_CLOEXEC);
+    if (m_event_fd == -1) {
+        close(m_listen_fd);
+        printf("%s\n", strerror(errno));
+        throw std::runtime_error("create eventfd error");
+    }
+    pthread_mutex_init(&m_wakeup_mutex, nullptr);
+}
+
+UringReactor::~UringReactor() {
+    close(m_event_fd);
+    close(m_listen_fd);
+    pthread_mutex_destroy(&m_wakeup_mutex);
+}
+
+/*
+ * probe once at startup,
+ * provided buffer rings and multishot accept came with linux 5.19
+ */
+bool UringReactor::supported() {
+    try {
+        Uring ring(8);
+        return ring.registerSparseFiles(8) && ring.setupBufRing(buf_group, 8, buf_size);
+    } catch (const std::runtime_error &) {
+        return false;
+    }
+}
+
+void UringReactor::start() {
+    int err = pthread_create(&m_thread, nullptr, worker, this);
+    if (err != 0)
+        throw std::runtime_error("In class UringReactor: create thread error");
+    pinThread(m_thread, m_id);
+}
+
+void UringReactor::join() {
+    if (m_thread != 0)
+        pthread_join(m_thread, nullptr);
+    m_thread = 0;
+}
+
+void UringReactor::notify(uint64_t ev) {
+    m_pending_ev.fetch_or(ev);
+    uint64_t one = 1;
+    write(m_event_fd, &one, sizeof(one));
+}
+
+void *UringReactor::worker(void *arg) {
+    auto reactor = static_cast<UringReactor *>(arg);
+    reactor->loop();
+    return reactor;
+}
+
+void UringReactor::loop() {
+    try {
+        m_ring.reset(new Uring(ring_entries));
+    } catch (const std::runtime_error &e) {
+        printf("%s\n", e.what());
+        return;
+    }
+    // conns never reach RLIMIT_NOFILE, kernel refuses a bigger table
+    struct rlimit limit;
+    m_files = max_files;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < m_files)
+        m_files = static_cast<unsigned>(limit.rlim_cur);
+    if (!m_ring->registerSparseFiles(m_files) ||
+        !m_ring->setupBufRing(buf_group, buf_num, buf_size)) {
+        printf("io_uring register error\n");
+        m_ring.reset();
+        return;
+    }
+    submitAccept();
+    submitNotify();
+
+    while (!m_stop) {
+        int ret = m_ring->submitAndWait(1);
+        if (ret == -1 && errno != EINTR && errno != EBUSY && errno != EAGAIN)
+            break;
+        m_ring->forEachCqe([this](const struct io_uring_cqe &cqe) { handleCqe(cqe); });
+        // accept canceled by budget goes on after this batch
+        m_accept_count = 0;
+        if (!m_accept_armed)
+            submitAccept();
+    }
+
+    // ring goes away with every op still in flight
+    for (uint32_t index = 0; index < m_states.size(); ++index) {
+        if (m_states[index].open) {
+            m_timer_wheel.remove(m_conns.at(index));
+            m_conns.at(index)->closeConn();
+        }
+    }
+    m_ring.reset();
+}
+
+void UringReactor::handleCqe(const struct io_uring_cqe &cqe) {
+    auto op = static_cast<URING_OP>(cqe.user_data >> 56);
+    uint64_t id = cqe.user_data & ConnTable::id_mask;
+    switch (op) {
+        case OP_ACCEPT:
+            handleAccept(cqe);
+            return;
+        case OP_NOTIFY:
+            handleNotify();
+            return;
+        case OP_NONE:
+        case OP_CANCEL:     // accept ended before its cancel
+            return;
+        default:
+            break;
+    }
+
+    if (m_conns.find(id) == nullptr) {
+        // slot released, e.g. failed FILES_UPDATE clearing it
+        Metrics::add(CNT_STALE_EVENT);
+        if (cqe.flags & IORING_CQE_F_BUFFER)
+            m_ring->recycleBuffer(static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+        return;
+    }
+    ConnState &state = m_states[ConnTable::index(id)];
+    if (op == OP_FILES_UPDATE) {
+        // only failures post a completion
+        closeUser(id);
+        return;
+    }
+    --state.pending;
+    if (op == OP_RECV)
+        handleRecv(id, cqe);
+    else
+        handleWrite(id, op == OP_WRITE ? cqe.res : (cqe.res < 0 ? cqe.res : 0));
+    if (state.open && state.closing && state.pending == 0)
+        releaseUser(id);
+}
+
+void UringReactor::handleAccept(const struct io_uring_cqe &cqe) {
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        // rearmed by loop after this batch
+        m_accept_armed = false;
+        m_accept_cancel = false;
+    }
+    int conn_fd = cqe.res;
+    if (conn_fd < 0)
+        return;
+    if (++m_accept_count >= m_config.accept_budget)
+        cancelAccept();
+    uint64_t id;
+    HttpConn *conn = m_conns.acquire(id);
+    uint32_t index = ConnTable::index(id);
+    if (index >= m_files) {
+        // fixed file table full
+        m_conns.release(id);
+        Metrics::add(CNT_ACCEPT_DROP);
+        Metrics::add(CNT_SYSCALL);
+        close(conn_fd);
+        return;
+    }
+    while (m_states.size() < m_conns.capacity())
+        m_states.emplace_back();
+
+    // multishot accept reports no address, only access log needs it
+    struct sockaddr_in conn_address;
+    memset(&conn_address, 0, sizeof(conn_address));
+    if (AccessLog::instance().enabled()) {
+        socklen_t conn_size = sizeof(conn_address);
+        Metrics::add(CNT_SYSCALL);
+        getpeername(conn_fd, reinterpret_cast<struct sockaddr *>(&conn_address), &conn_size);
+    }
+    Metrics::add(CNT_ACCEPT);
+    conn->init(conn_fd, conn_address, this, id);
+    m_timer_wheel.add(conn, m_idle_ticks);
+
+    ConnState &state = m_states[index];
+    memset(&state, 0, sizeof(state));
+    state.fixed_fd = conn_fd;
+    state.open = true;
+
+    // fixed file slot index holds the socket, first recv waits for it
+    struct io_uring_sqe *sqe = getSqe(OP_FILES_UPDATE, id);
+    if (sqe == nullptr) {
+        closeUser(id);
+        return;
+    }
+    sqe->opcode = IORING_OP_FILES_UPDATE;
+    sqe->fd = -1;
+    sqe->addr = reinterpret_cast<uint64_t>(&state.fixed_fd);
+    sqe->len = 1;
+    sqe->off = index;
+    sqe->flags = IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS;
+    submitRecv(id);
+}
+
+void UringReactor::handleNotify() {
+    uint64_t ev = m_pending_ev.exchange(0);
+    if (ev & EV_WAKE)
+        resumeStreams();
+    if (ev & EV_TICK)
+        m_timer_wheel.tick();
+    if (ev & EV_STOP)
+        m_stop = true;
+    else
+        submitNotify();
+}
+
+void UringReactor::handleRecv(uint64_t id, const struct io_uring_cqe &cqe) {
+    ConnState &state = m_states[ConnTable::index(id)];
+    HttpConn *conn = m_conns.at(ConnTable::index(id));
+    state.reading = false;
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+        // bytes are copied into conn, buffer goes back at once
+        auto bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        bool ok = state.closing || cqe.res <= 0 ||
+                  conn->appendReq(m_ring->buffer(bid), static_cast<size_t>(cqe.res));
+        m_ring->recycleBuffer(bid);
+        if (!ok) {
+            closeUser(id);
+            return;
+        }
+    }
+    if (state.closing)
+        return;
+    if (cqe.res == -ENOBUFS || cqe.res == -ECANCELED) {
+        // no buffer left, or link after writev broken by a short write
+        if (!state.writing)
+            submitRecv(id);
+        return;
+    }
+    if (cqe.res <= 0) {
+        // client closed or error
+        closeUser(id);
+        return;
+    }
+
+    m_timer_wheel.refresh(conn, m_idle_ticks);
+    if (state.writing || conn->writePending()) {
+        // parsed once queued responses are sent
+        return;
+    }
+    conn->run();
+    if (!conn->writePending() && !state.closing)
+        submitRecv(id);
+}
+
+void UringReactor::handleWrite(uint64_t id, int res) {
+    ConnState &state = m_states[ConnTable::index(id)];
+    state.writing = false;
+    if (state.closing)
+        return;
+    if (res < 0) {
+        closeUser(id);
+        return;
+    }
+    HttpConn *conn = m_conns.at(ConnTable::index(id));
+    if (res > 0)
+        conn->consumeSent(res);
+    m_timer_wheel.refresh(conn, m_idle_ticks);
+    continueWrite(id);
+}
+
+struct io_uring_sqe *UringReactor::getSqe(URING_OP op, uint64_t id) {
+    struct io_uring_sqe *sqe = m_ring->getSqe();
+    if (sqe == nullptr)
+        return nullptr;
+    sqe->user_data = (static_cast<uint64_t>(op) << 56) | id;
+    if (op == OP_RECV || op == OP_WRITE || op == OP_POLL_OUT)
+        ++m_states[ConnTable::index(id)].pending;
+    return sqe;
+}
+
+void UringReactor::submitAccept() {
+    struct io_uring_sqe *sqe = getSqe(OP_ACCEPT, 0);
+    if (sqe == nullptr)
+        return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = m_listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    m_accept_armed = true;
+}
+
+/*
+ * stop multishot accept until the completion batch is served,
+ * so a connection storm can not starve established conns
+ */
+void UringReactor::cancelAccept() {
+    if (!m_accept_armed || m_accept_cancel)
+        return;
+    struct io_uring_sqe *sqe = getSqe(OP_CANCEL, 0);
+    if (sqe == nullptr)
+        return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = static_cast<uint64_t>(OP_ACCEPT) << 56;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    m_accept_cancel = true;
+}
+
+void UringReactor::submitNotify() {
+    struct io_uring_sqe *sqe = getSqe(OP_NOTIFY, 0);
+    if (sqe == nullptr)
+        return;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = m_event_fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&m_event_value);
+    sqe->len = sizeof(m_event_value);
+}
+
+/*
+ * recv at most what conn can take into a provided buffer,
+ * nothing is armed while read buffer is full
+ */
+void UringReactor::submitRecv(uint64_t id) {
+    uint32_t index = ConnTable::index(id);
+    ConnState &state = m_states[index];
+    if (state.reading || state.closing)
+        return;
+    size_t space = m_conns.at(index)->readSpace();
+    if (space == 0)
+        return;
+    struct io_uring_sqe *sqe = getSqe(OP_RECV, id);
+    if (sqe == nullptr) {
+        closeUser(id);
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = static_cast<int>(index);
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+    sqe->buf_group = buf_group;
+    sqe->len = static_cast<uint32_t>(space < buf_size ? space : buf_size);
+    state.reading = true;
+}
+
+/*
+ * send queued responses: mapped bytes by writev, sendfile() bodies
+ * inline once socket is writable. a writev covering every queued byte
+ * of a kept conn carries a linked recv for the next request.
+ */
+void UringReactor::continueWrite(uint64_t id) {
+    uint32_t index = ConnTable::index(id);
+    ConnState &state = m_states[index];
+    HttpConn *conn = m_conns.at(index);
+    if (state.writing || state.closing)
+        return;
+    while (conn->writePending()) {
+        if (conn->fileBodyNext()) {
+            Metrics::add(CNT_SYSCALL);
+            ssize_t bytes = conn->sendFileBody();
+            if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                submitPollOut(id);
+                return;
+            }
+            if (bytes <= 0) {
+                closeUser(id);
+                return;
+            }
+            conn->consumeSent(bytes);
+            continue;
+        }
+
+        bool more = false;
+        int count = conn->buildWriteVec(more);
+        struct io_uring_sqe *sqe = getSqe(OP_WRITE, id);
+        if (sqe == nullptr) {
+            closeUser(id);
+            return;
+        }
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->fd = static_cast<int>(index);
+        sqe->flags = IOSQE_FIXED_FILE;
+        sqe->addr = reinterpret_cast<uint64_t>(conn->writeVec());
+        sqe->len = static_cast<uint32_t>(count);
+        state.writing = true;
+        if (!more && !state.reading && conn->keepAfterWrite() && conn->readSpace() != 0) {
+            sqe->flags |= IOSQE_IO_LINK;
+            submitRecv(id);
+        }
+        return;
+    }
+    if (conn->writeStalled()) {
+        // stream had nothing, pulled again once its waker is called
+        return;
+    }
+    if (!conn->finishWrite())
+        closeUser(id);
+}
+
+// completes through handleWrite() with nothing sent
+void UringReactor::submitPollOut(uint64_t id) {
+    struct io_uring_sqe *sqe = getSqe(OP_POLL_OUT, id);
+    if (sqe == nullptr) {
+        closeUser(id);
+        return;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = static_cast<int>(ConnTable::index(id));
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->poll32_events = POLLOUT;
+    m_states[ConnTable::index(id)].writing = true;
+}
+
+void UringReactor::waitRead(HttpConn *conn) {
+    submitRecv(conn->connId());
+}
+
+void UringReactor::waitWrite(HttpConn *conn) {
+    continueWrite(conn->connId());
+}
+
+void UringReactor::dropConn(HttpConn *conn) {
+    closeUser(conn->connId());
+}
+
+void UringReactor::wakeStream(uint64_t conn_id) {
+    pthread_mutex_lock(&m_wakeup_mutex);
+    m_wakeups.push_back(conn_id);
+    pthread_mutex_unlock(&m_wakeup_mutex);
+    notify(EV_WAKE);
+}
+
+// continueWrite() skips a conn closing or with a write in flight
+void UringReactor::resumeStreams() {
+    std::vector<uint64_t> wakeups;
+    pthread_mutex_lock(&m_wakeup_mutex);
+    wakeups.swap(m_wakeups);
+    pthread_mutex_unlock(&m_wakeup_mutex);
+    for (uint64_t conn_id : wakeups) {
+        HttpConn *conn = m_conns.find(conn_id);
+        if (conn == nullptr || !m_states[ConnTable::index(conn_id)].open || !conn->writeStalled())
+            continue;
+        m_timer_wheel.refresh(conn, m_idle_ticks);
+        continueWrite(conn_id);
+    }
+}
+
+// requests always run on ring thread, see handleRecv()
+void UringReactor::dispatch(HttpConn *conn) {
+    conn->run();
+}
+
+/*
+ * ops in flight still point at conn, shutdown() ends them
+ * and conn is released with the last completion
+ */
+void UringReactor::closeUser(uint64_t id) {
+    uint32_t index = ConnTable::index(id);
+    ConnState &state = m_states[index];
+    if (!state.open || state.closing)
+        return;
+    state.closing = true;
+    m_timer_wheel.remove(m_conns.at(index));
+    if (state.pending == 0) {
+        releaseUser(id);
+        return;
+    }
+    Metrics::add(CNT_SYSCALL);
+    shutdown(m_conns.at(index)->fd(), SHUT_RDWR);
+}
+
+/*
+ * slot goes back to ConnTable, a late completion
+ * of the old conn no longer matches its id
+ */
+void UringReactor::releaseUser(uint64_t id) {
+    uint32_t index = ConnTable::index(id);
+    struct io_uring_sqe *sqe = getSqe(OP_FILES_UPDATE, id);
+    if (sqe != nullptr) {
+        sqe->opcode = IORING_OP_FILES_UPDATE;
+        sqe->fd = -1;
+        sqe->addr = reinterpret_cast<uint64_t>(&no_file);
+        sqe->len = 1;
+        sqe->off = index;
+        sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    }
+    m_states[index].open = false;
+    m_conns.release(id);
+    m_conns.at(index)->closeConn();
+}
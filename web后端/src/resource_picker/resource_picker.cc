@@ -0,0 +1,105 @@
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <new>
+
+#include <dirent.h>
+#include <sched.h>
+
+#include "mime_types.h"
+#include "resource_picker.h"
+
+// xorshift64*, seeded per thread from clock and stack address
+static uint64_t nextRandom() {
+    static thread_local uint64_t state = 0;
+    if (state == 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        state = ((static_cast<uint64_t>(now.tv_nsec) * 0x9e3779b97f4a7c15ULL) ^
+                 reinterpret_cast<uintptr_t>(&state)) | 1;
+    }
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545f4914f6cdd1dULL;
+}
+
+static bool isImage(const char *name) {
+    return strncmp(mimeType(name).type, "image/", 6) == 0;
+}
+
+ResourcePicker &ResourcePicker::instance() {
+    static ResourcePicker picker;
+    return picker;
+}
+
+ResourcePicker::ResourcePicker() : m_table(nullptr) {}
+
+ResourcePicker::~ResourcePicker() {
+    delete m_table.load();
+    for (Reader *reader : m_readers) {
+        reader->~Reader();
+        free(reader);
+    }
+}
+
+ResourcePicker::Reader *ResourcePicker::localReader() {
+    static thread_local Reader *reader = nullptr;
+    if (reader == nullptr) {
+        // Reader is cache line aligned, before C++17 new does not honour that
+        void *memory = nullptr;
+        if (posix_memalign(&memory, alignof(Reader), sizeof(Reader)) != 0)
+            throw std::bad_alloc();
+        reader = new(memory) Reader();
+        std::lock_guard<std::mutex> g(m_mutex);
+        m_readers.push_back(reader);
+    }
+    return reader;
+}
+
+/*
+ * images of dir, loaded through FileCache so the table holds their
+ * cached bodies. .gz/.br siblings are variants, never entries.
+ */
+bool ResourcePicker::load(const std::string &dir) {
+    DIR *resource_dir = opendir(dir.c_str());
+    if (resource_dir == nullptr)
+        return false;
+    std::unique_ptr<Table> table(new Table());
+    struct dirent *ptr;
+    while ((ptr = readdir(resource_dir)) != nullptr) {
+        if (ptr->d_type != DT_REG || !isImage(ptr->d_name))
+            continue;
+        std::shared_ptr<const CachedFile> file;
+        std::string path = dir + "/" + ptr->d_name;
+        if (FileCache::instance().get(path.c_str(), 1u << ENC_IDENTITY, file) == FILE_REQUEST)
+            table->files.push_back(std::move(file));
+    }
+    closedir(resource_dir);
+
+    std::lock_guard<std::mutex> g(m_mutex);
+    const Table *old = m_table.exchange(table.release());
+    // grace period: a reader active now may still use old
+    for (Reader *reader : m_readers) {
+        while (reader->active.load())
+            sched_yield();
+    }
+    delete old;
+    return true;
+}
+
+bool ResourcePicker::pick(std::shared_ptr<const CachedFile> &file) {
+    Reader *reader = localReader();
+    // seq_cst pairs with exchange() in load(): either load() waits
+    // for this reader or this reader sees the new table
+    reader->active.store(true);
+    const Table *table = m_table.load();
+    bool picked = table != nullptr && !table->files.empty();
+    if (picked) {
+        // multiply-shift maps 32 random bits onto [0, size) without division
+        uint64_t index = ((nextRandom() >> 32) * table->files.size()) >> 32;
+        file = table->files[index];
+    }
+    reader->active.store(false, std::memory_order_release);
+    return picked;
+}
@@ -0,0 +1,209 @@
+#include <cstdio>
+#include <cstring>
+
+#include "router.h"
+
+StrView RouteMatch::param(const char *name) const {
+    for (int i = 0; i < param_count; ++i) {
+        if (strcmp(names[i], name) == 0)
+            return params[i];
+    }
+    return {nullptr, 0};
+}
+
+Router &Router::instance() {
+    static Router router;
+    return router;
+}
+
+Router::Router() {
+    clear();
+}
+
+void Router::clear() {
+    m_nodes.clear();
+    m_routes.clear();
+    newNode("", 0);
+}
+
+int Router::newNode(const char *label, size_t size) {
+    Node node;
+    node.label.assign(label, size);
+    node.param_child = -1;
+    node.wildcard_child = -1;
+    node.methods = 0;
+    for (int &route : node.routes)
+        route = -1;
+    m_nodes.push_back(std::move(node));
+    return static_cast<int>(m_nodes.size()) - 1;
+}
+
+/*
+ * walk static path from node index, splitting edges where path
+ * leaves them, return node at end of path
+ */
+int Router::insertStatic(int index, const char *path, size_t size) {
+    while (size > 0) {
+        const char *slot = static_cast<const char *>(memchr(m_nodes[index].indices.data(), *path,
+                                                             m_nodes[index].indices.size()));
+        if (slot == nullptr) {
+            int child = newNode(path, size);
+            m_nodes[index].indices.push_back(*path);
+            m_nodes[index].children.push_back(child);
+            return child;
+        }
+        size_t pos = slot - m_nodes[index].indices.data();
+        int child = m_nodes[index].children[pos];
+        const std::string &label = m_nodes[child].label;
+        size_t common = 0;
+        while (common < label.size() && common < size && label[common] == path[common])
+            ++common;
+        if (common < label.size()) {
+            // path leaves edge in the middle, split it there
+            int mid = newNode(label.data(), common);
+            m_nodes[child].label.erase(0, common);
+            m_nodes[mid].indices.push_back(m_nodes[child].label[0]);
+            m_nodes[mid].children.push_back(child);
+            m_nodes[index].children[pos] = mid;
+            child = mid;
+        }
+        index = child;
+        path += common;
+        size -= common;
+    }
+    return index;
+}
+
+bool Router::registerHandler(HTTP_METHOD method, const char *pattern, RouteHandler handler, bool offload,
+                             RouteHandler body) {
+    if (pattern[0] != '/') {
+        printf("route %s: must start with '/'\n", pattern);
+        return false;
+    }
+    int index = 0;
+    const char *p = pattern;
+    while (*p != '\0') {
+        if (*p == ':' || *p == '*') {
+            bool wildcard = *p == '*';
+            const char *name = p + 1;
+            size_t size = wildcard ? strlen(name) : strcspn(name, "/");
+            if (p[-1] != '/' || size == 0 || (wildcard && strchr(name, '/') != nullptr)) {
+                printf("route %s: parameter must be a whole named segment, '*' the last one\n", pattern);
+                return false;
+            }
+            int child = wildcard ? m_nodes[index].wildcard_child : m_nodes[index].param_child;
+            if (child == -1) {
+                child = newNode(name, size);
+                (wildcard ? m_nodes[index].wildcard_child : m_nodes[index].param_child) = child;
+            } else if (m_nodes[child].label.compare(0, std::string::npos, name, size) != 0) {
+                printf("route %s: parameter named differently by another route\n", pattern);
+                return false;
+            }
+            index = child;
+            p = name + size;
+            continue;
+        }
+        size_t size = strcspn(p, ":*");
+        index = insertStatic(index, p, size);
+        p += size;
+    }
+
+    Node &node = m_nodes[index];
+    if (node.routes[method] != -1) {
+        printf("route %s: registered twice\n", pattern);
+        return false;
+    }
+    node.routes[method] = static_cast<int>(m_routes.size());
+    node.methods |= 1u << method;
+    m_routes.push_back(Route{pattern, std::move(handler), nullptr, offload, std::move(body)});
+    return true;
+}
+
+int Router::routeOf(const Node &node, HTTP_METHOD method) {
+    int route = node.routes[method];
+    if (route == -1 && method == HEAD)
+        route = node.routes[GET];
+    return route;
+}
+
+/*
+ * depth first match of path[0, end) below node index, node gets
+ * node with a route of method for the path. other gets first node
+ * matching the path under other methods only, for 405.
+ */
+bool Router::find(int index, const char *path, const char *end, HTTP_METHOD method,
+                  RouteMatch &match, int &node, int &other) const {
+    const Node &current = m_nodes[index];
+    if (path == end && current.methods != 0) {
+        if (routeOf(current, method) != -1) {
+            node = index;
+            return true;
+        }
+        if (other == -1)
+            other = index;
+    }
+    if (path < end) {
+        const char *slot = static_cast<const char *>(memchr(current.indices.data(), *path, current.indices.size()));
+        if (slot != nullptr) {
+            int child = current.children[slot - current.indices.data()];
+            const std::string &label = m_nodes[child].label;
+            if (static_cast<size_t>(end - path) >= label.size() &&
+                memcmp(path, label.data(), label.size()) == 0 &&
+                find(child, path + label.size(), end, method, match, node, other))
+                return true;
+        }
+        if (current.param_child != -1 && match.param_count < RouteMatch::max_params) {
+            auto slash = static_cast<const char *>(memchr(path, '/', end - path));
+            const char *segment_end = slash == nullptr ? end : slash;
+            if (segment_end != path) {
+                int param = match.param_count++;
+                match.names[param] = m_nodes[current.param_child].label.c_str();
+                match.params[param] = {path, static_cast<size_t>(segment_end - path)};
+                if (find(current.param_child, segment_end, end, method, match, node, other))
+                    return true;
+                --match.param_count;
+            }
+        }
+    }
+    if (current.wildcard_child != -1 && match.param_count < RouteMatch::max_params) {
+        if (routeOf(m_nodes[current.wildcard_child], method) != -1) {
+            int param = match.param_count++;
+            match.names[param] = m_nodes[current.wildcard_child].label.c_str();
+            match.params[param] = {path, static_cast<size_t>(end - path)};
+            node = current.wildcard_child;
+            return true;
+        }
+        if (other == -1)
+            other = current.wildcard_child;
+    }
+    return false;
+}
+
+ROUTE_RESULT Router::match(HTTP_METHOD method, const char *target, size_t size, RouteMatch &match) const {
+    const char *end = target + size;
+    auto question = static_cast<const char *>(memchr(target, '?', size));
+    match.query = {end, 0};
+    if (question != nullptr) {
+        match.query = {question + 1, static_cast<size_t>(end - question - 1)};
+        end = question;
+    }
+    match.route = nullptr;
+    match.allow = 0;
+    match.param_count = 0;
+
+    int index = -1;
+    int other = -1;
+    bool found = find(0, target, end, method, match, index, other);
+    if (!found && other == -1)
+        return ROUTE_NOT_FOUND;
+    const Node &node = m_nodes[found ? index : other];
+    match.allow = node.methods;
+    if (node.methods & (1u << GET))
+        match.allow |= 1u << HEAD;
+    if (!found) {
+        match.param_count = 0;
+        return ROUTE_BAD_METHOD;
+    }
+    match.route = &m_routes[routeOf(node, method)];
+    return ROUTE_FOUND;
+}
@@ -0,0 +1,172 @@
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "router.h"
+#include "file_cache.h"
+#include "metrics.h"
+#include "resource_picker.h"
+
+static HTTP_CODE servePage(HttpConn &conn, const RouteMatch &match) {
+    return conn.respondFile(match.route->file);
+}
+
+// here and not in router.cc, so the trie builds without HttpConn (route_bench)
+bool Router::registerPage(const char *pattern, const char *file) {
+    if (!registerHandler(GET, pattern, servePage))
+        return false;
+    m_routes.back().file = file;
+    return true;
+}
+
+// any file under root, e.g. /funny_mystery_box/a.jpg
+static HTTP_CODE serveStatic(HttpConn &conn, const RouteMatch &match) {
+    StrView rest = match.param("path");
+    char path[PATH_MAX];
+    switch (normalizePath(rest.data, rest.size, "index.html", path, sizeof(path))) {
+        case PATH_OK:
+            return conn.respondFile(path);
+        case PATH_FORBIDDEN:
+            return FORBIDDEN_REQUEST;
+        default:
+            return BAD_REQUEST;
+    }
+}
+
+static HTTP_CODE serveStats(HttpConn &conn, const RouteMatch &match) {
+    if (match.query.size == 17 && memcmp(match.query.data, "format=prometheus", 17) == 0)
+        return conn.respondBody(Metrics::renderPrometheus(), "text/plain; version=0.0.4");
+    return conn.respondBody(Metrics::renderJson(), "application/json");
+}
+
+static HTTP_CODE serveRandomFunny(HttpConn &conn, const RouteMatch &) {
+    std::shared_ptr<const CachedFile> file;
+    if (!ResourcePicker::instance().pick(file))
+        return NO_RESOURCE;
+    return conn.respondCached(std::move(file));
+}
+
+static const size_t max_upload_name = 128;
+
+// one path segment of [A-Za-z0-9._-] not starting with '.'
+static bool uploadName(StrView name) {
+    if (name.size == 0 || name.size > max_upload_name || name.data[0] == '.')
+        return false;
+    for (size_t i = 0; i < name.size; ++i) {
+        char c = name.data[i];
+        if (!isalnum(static_cast<unsigned char>(c)) && c != '.' && c != '_' && c != '-')
+            return false;
+    }
+    return true;
+}
+
+/*
+ * POST /upload/<name> before its body is read: body goes to a temp
+ * file under upload/, a taken name is refused right away
+ */
+static HTTP_CODE beginUpload(HttpConn &conn, const RouteMatch &match) {
+    StrView name = match.param("name");
+    if (!uploadName(name))
+        return FORBIDDEN_REQUEST;
+    std::string file(name.data, name.size);
+    Metrics::add(CNT_SYSCALL);
+    if (access(("upload/" + file).c_str(), F_OK) == 0)
+        return CONFLICT;
+    return conn.receiveBodyTo("upload/." + file + "." + std::to_string(conn.fd()) + ".part");
+}
+
+/*
+ * body is complete: temp file is linked as <name>, link() never
+ * replaces an existing file like rename() would
+ */
+static HTTP_CODE serveUpload(HttpConn &conn, const RouteMatch &match) {
+    std::string temp = conn.takeBodyFile();
+    if (temp.empty())
+        return INTERNAL_ERROR;
+    StrView name = match.param("name");
+    std::string path = "upload/" + std::string(name.data, name.size);
+    Metrics::add(CNT_SYSCALL, 2);
+    int ret = link(temp.c_str(), path.c_str());
+    int err = errno;
+    unlink(temp.c_str());
+    if (ret == -1)
+        return err == EEXIST ? CONFLICT : INTERNAL_ERROR;
+    return conn.respondCreated("/" + path);
+}
+
+/*
+ * uploaded files as a JSON array. the directory is read here, on the
+ * worker running the handler; the listing is streamed in pieces of 64
+ * entries as socket drains, the writer thread only hands them out
+ */
+static HTTP_CODE serveUploadList(HttpConn &conn, const RouteMatch &) {
+    DIR *dir = opendir("upload");
+    if (dir == nullptr)
+        return NO_RESOURCE;
+    auto pieces = std::make_shared<std::vector<std::string>>();
+    std::string piece;
+    char line[NAME_MAX + 64];
+    int count = 0;
+    while (struct dirent *entry = readdir(dir)) {
+        // temp files of uploads in progress start with '.',
+        // names needing JSON escapes were never accepted by POST
+        const char *name = entry->d_name;
+        bool plain = name[0] != '.';
+        for (const char *c = name; plain && *c != '\0'; ++c)
+            plain = *c != '"' && *c != '\\' && static_cast<unsigned char>(*c) >= 0x20;
+        if (!plain)
+            continue;
+        struct stat file_stat;
+        if (fstatat(dirfd(dir), name, &file_stat, 0) != 0 || !S_ISREG(file_stat.st_mode))
+            continue;
+        snprintf(line, sizeof(line), "%s\n{\"name\":\"%s\",\"size\":%lld}", count == 0 ? "" : ",",
+                 name, static_cast<long long>(file_stat.st_size));
+        piece += line;
+        if (++count % 64 == 0) {
+            pieces->push_back(std::move(piece));
+            piece.clear();
+        }
+    }
+    closedir(dir);
+    piece += count == 0 ? "]\n" : "\n]\n";
+    pieces->push_back(std::move(piece));
+
+    ResponseBody &body = conn.respondWith("application/json");
+    body.append("[");
+    size_t next = 0;
+    body.stream([pieces, next](std::string &chunk) mutable {
+        chunk.swap((*pieces)[next++]);
+        return next < pieces->size();
+    });
+    return BODY_REQUEST;
+}
+
+void registerDefaultRoutes(Router &router, bool uploads) {
+    bool ok = router.registerPage("/", "index.html") &&
+              router.registerPage("/funny_box.html", "funny_box.html") &&
+              router.registerHandler(GET, "/__stats", serveStats, true) &&
+              router.registerHandler(GET, "/random_funny", serveRandomFunny) &&
+              router.registerHandler(GET, "/*path", serveStatic);
+    if (ok && uploads)
+        ok = router.registerHandler(POST, "/upload/:name", serveUpload, false, beginUpload) &&
+             router.registerHandler(GET, "/upload/", serveUploadList, true);
+    if (!ok)
+        exit(1);
+    if (uploads && mkdir("upload", 0755) == -1 && errno != EEXIST) {
+        printf("%s\n", strerror(errno));
+        exit(1);
+    }
+    // anyone may have written them, never rendered by a browser as our page
+    FileCache::instance().addAttachment("/upload/");
+}
@@ -1,56 +1,198 @@
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <new>
+
+#include "http_conn.h"
+
 #include <pthread.h>
+#include <unistd.h>
 #include <stdexcept>
 
 #include "threadpool.h"
 #include "common.h"
+#include "metrics.h"
+
+static inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+ThreadPool::Worker::Worker(size_t capacity) : queue(capacity), parked(false), thread(0), pool(nullptr), id(0) {
+    sem_init(&sem, 0, 0);
+}
+
+ThreadPool::Worker::~Worker() {
+    sem_destroy(&sem);
+}
+
+ThreadPool::Worker *ThreadPool::newWorker(size_t capacity) {
+    void *memory = nullptr;
+    if (posix_memalign(&memory, alignof(Worker), sizeof(Worker)) != 0)
+        throw std::bad_alloc();
+    return new(memory) Worker(capacity);
+}
+
+void ThreadPool::WorkerDeleter::operator()(Worker *worker) const {
+    worker->~Worker();
+    free(worker);
+}
 
 ThreadPool::ThreadPool(int thread_num, int max_wait_task)
-        : m_thread_num(thread_num), m_max_wait_task(max_wait_task), m_stop(false) {
+        : m_thread_num(thread_num), m_max_wait_task(max_wait_task),
+          m_next_worker(0), m_parked_num(0), m_searching_num(0), m_stop(false) {
     if (m_thread_num <= 0 || max_wait_task <= 0)
         throw std::range_error("In class ThreadPool: invalid init parameter");
-    pthread_attr_t detach_attr;
-    pthread_attr_init(&detach_attr);
-    pthread_attr_setdetachstate(&detach_attr, PTHREAD_CREATE_DETACHED);
+    m_spin_count = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? max_spin_count : 1;
+
+    size_t capacity = (m_max_wait_task + m_thread_num - 1) / m_thread_num;
+    for (int i = 0; i < m_thread_num; ++i) {
+        m_workers.emplace_back(newWorker(capacity));
+        m_workers[i]->pool = this;
+        m_workers[i]->id = i;
+    }
 
     for (int i = 0; i < m_thread_num; ++i) {
-        pthread_t thread;
-        int err = pthread_create(&thread, &detach_attr, worker, this);
-        if (err == -1) {
-            pthread_attr_destroy(&detach_attr);
+        int err = pthread_create(&m_workers[i]->thread, nullptr, worker, m_workers[i].get());
+        if (err != 0) {
+            m_stop = true;
+            for (int j = 0; j < i; ++j) {
+                sem_post(&m_workers[j]->sem);
+                pthread_join(m_workers[j]->thread, nullptr);
+            }
             throw std::runtime_error("In class ThreadPool: create thread error");
         }
     }
-
-    pthread_attr_destroy(&detach_attr);
 }
 
+/*
+ * stop() unless done already, tasks still in queue are run first.
+ */
 ThreadPool::~ThreadPool() {
-    m_stop = true;
+    stop();
+}
+
+/*
+ * called once nothing appends tasks any more, a second call returns at once.
+ * workers leave their loop and drain every queue before they exit.
+ */
+void ThreadPool::stop() {
+    if (m_stop.exchange(true))
+        return;
+    for (auto &w : m_workers)
+        sem_post(&w->sem);
+    for (auto &w : m_workers)
+        pthread_join(w->thread, nullptr);
 }
 
+/*
+ * push task to next worker queue in round robin order,
+ * try other queues if it is full.
+ * return false if all queues are full.
+ */
 bool ThreadPool::appendTask(Runner *runner) {
-    std::lock_guard<std::mutex> g(m_queue_mutex);
-    if (m_task_queue.size() >= m_max_wait_task)
-        return false;
-    m_task_queue.push(runner);
-    m_cv.notify_one();
-    return true;
+    Task task{runner, Metrics::nowNs()};
+    unsigned start = m_next_worker.fetch_add(1, std::memory_order_relaxed) % m_thread_num;
+    for (int i = 0; i < m_thread_num; ++i) {
+        int ind = static_cast<int>((start + i) % m_thread_num);
+        if (m_workers[ind]->queue.push(task)) {
+            wakeUp(ind);
+            return true;
+        }
+    }
+    Metrics::add(CNT_TASK_REJECT);
+    return false;
 }
 
 void *ThreadPool::worker(void *arg) {
-    auto runner = static_cast<ThreadPool *>(arg);
-    runner->run();
-    return runner;
-}
-
-void ThreadPool::run() {
-    while (!m_stop) {
-        std::unique_lock<std::mutex> lk(m_queue_mutex);
-        m_cv.wait(lk, [this]() { return !m_task_queue.empty(); });
-        Runner *runner = m_task_queue.front();
-        m_task_queue.pop();
-        lk.unlock();
-        if (runner != nullptr)
-            runner->run();
+    auto self = static_cast<Worker *>(arg);
+    self->pool->run(*self);
+    return self;
+}
+
+void ThreadPool::run(Worker &self) {
+    Task task{nullptr, 0};
+    while (!m_stop.load(std::memory_order_relaxed)) {
+        // spin before park
+        bool got = false;
+        m_searching_num.fetch_add(1);
+        for (int i = 0; i < m_spin_count && !got; ++i) {
+            got = popTask(self, task);
+            if (!got)
+                cpuRelax();
+        }
+        int searching = m_searching_num.fetch_sub(1);
+        if (got) {
+            // last searcher found work, more may be queued, keep one more awake
+            if (searching == 1)
+                wakeUp(self.id + 1);
+            if (task.runner != nullptr) {
+                Metrics::record(HIST_QUEUE_WAIT, Metrics::nowNs() - task.enqueue_ns);
+                task.runner->run();
+            }
+            continue;
+        }
+
+        // park, recheck queues after announcing
+        // so a task pushed meanwhile is never missed
+        self.parked.store(true);
+        m_parked_num.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if ((hasTask() || m_stop.load()) && self.parked.exchange(false)) {
+            m_parked_num.fetch_sub(1);
+            continue;
+        }
+        // woken up by wakeUp() or stop()
+        Metrics::add(CNT_SYSCALL);
+        while (sem_wait(&self.sem) == -1 && errno == EINTR) {}
+    }
+    // queued before stop(), a conn is handed back to its loop, not dropped
+    while (popTask(self, task)) {
+        if (task.runner != nullptr)
+            task.runner->run();
+    }
+}
+
+/*
+ * pop from own queue first, then steal from others
+ */
+bool ThreadPool::popTask(Worker &self, Task &task) {
+    if (self.queue.pop(task))
+        return true;
+    for (int i = 1; i < m_thread_num; ++i) {
+        Worker &victim = *m_workers[(self.id + i) % m_thread_num];
+        if (victim.queue.pop(task))
+            return true;
+    }
+    return false;
+}
+
+bool ThreadPool::hasTask() const {
+    for (auto &w : m_workers) {
+        if (!w->queue.empty())
+            return true;
+    }
+    return false;
+}
+
+/*
+ * wake up owner of queue hint if it is parked,
+ * otherwise any parked worker to steal the task.
+ * skipped if some worker is still searching, it will
+ * find the task or see it when rechecking before park.
+ */
+void ThreadPool::wakeUp(int hint) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_searching_num.load() > 0 || m_parked_num.load() == 0)
+        return;
+    for (int i = 0; i < m_thread_num; ++i) {
+        Worker &w = *m_workers[(hint + i) % m_thread_num];
+        if (w.parked.load() && w.parked.exchange(false)) {
+            m_parked_num.fetch_sub(1);
+            Metrics::add(CNT_SYSCALL);
+            sem_post(&w.sem);
+            return;
+        }
     }
 }
@@ -0,0 +1,66 @@
+#include <stdexcept>
+
+#include "timer_wheel.h"
+
+TimerWheel::TimerWheel(int slot_num) : m_slots(slot_num, nullptr), m_cur_slot(0) {
+    if (slot_num <= 0)
+        throw std::range_error("In class TimerWheel: invalid slot number");
+}
+
+/*
+ * node will expire after ticks times of tick()
+ */
+void TimerWheel::add(TimerNode *node, int ticks) {
+    if (node->m_slot != -1)
+        remove(node);
+    if (ticks <= 0)
+        ticks = 1;
+    int slot_num = static_cast<int>(m_slots.size());
+    node->m_rotation = (ticks - 1) / slot_num;
+    node->m_slot = (m_cur_slot + ticks) % slot_num;
+
+    // push front
+    node->m_prev = nullptr;
+    node->m_next = m_slots[node->m_slot];
+    if (node->m_next != nullptr)
+        node->m_next->m_prev = node;
+    m_slots[node->m_slot] = node;
+}
+
+void TimerWheel::remove(TimerNode *node) {
+    if (node->m_slot == -1)
+        return;
+    if (node->m_prev != nullptr)
+        node->m_prev->m_next = node->m_next;
+    else
+        m_slots[node->m_slot] = node->m_next;
+    if (node->m_next != nullptr)
+        node->m_next->m_prev = node->m_prev;
+    node->m_prev = nullptr;
+    node->m_next = nullptr;
+    node->m_slot = -1;
+}
+
+void TimerWheel::refresh(TimerNode *node, int ticks) {
+    remove(node);
+    add(node, ticks);
+}
+
+/*
+ * move to next slot, expire nodes whose rotation runs out.
+ * node is removed before onTimeout(), so callback may re-add it.
+ */
+void TimerWheel::tick() {
+    m_cur_slot = (m_cur_slot + 1) % static_cast<int>(m_slots.size());
+    TimerNode *node = m_slots[m_cur_slot];
+    while (node != nullptr) {
+        TimerNode *next = node->m_next;
+        if (node->m_rotation > 0) {
+            --node->m_rotation;
+        } else {
+            remove(node);
+            node->onTimeout();
+        }
+        node = next;
+    }
+}